@@ -0,0 +1,215 @@
+// Renders subtitle scripts through assrender.TextSub end to end, with the
+// plugin loaded into the mockvs core and frames requested by a pool of
+// threads like a VapourSynth output would.
+//
+//   assrender_e2e [-f FORMAT,...] [-j THREADS] [-l LOOKAHEAD] [-n FRAMES] [-s WIDTHxHEIGHT] [SCRIPT ...]
+//
+// Without scripts the checked-in corpus is used. Prints frames/s, request
+// latency percentiles and the peak resident memory of every script and format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mockvs.h"
+#include "stats.h"
+#include "sysinfo.h"
+#include "thread.h"
+
+VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin* plugin);
+
+
+typedef struct {
+    VSNodeRef* node;
+    int frames;
+    int next;
+    int64_t* latency;
+    char error[512];
+    mutex lock;
+} run_state;
+
+static void* worker(void* arg)
+{
+    run_state* rs = arg;
+    const VSAPI* vsapi = mockvs_api();
+
+    for (;;) {
+        char error[512];
+        int n;
+
+        mutex_lock(&rs->lock);
+        n = rs->error[0] ? rs->frames : rs->next++;
+        mutex_unlock(&rs->lock);
+
+        if (n >= rs->frames)
+            break;
+
+        int64_t t0 = monotonic_ns();
+        const VSFrameRef* f = mockvs_get_frame(rs->node, n, error, sizeof(error));
+        rs->latency[n] = monotonic_ns() - t0;
+
+        if (!f) {
+            mutex_lock(&rs->lock);
+            snprintf(rs->error, sizeof(rs->error), "frame %d: %s", n, error);
+            mutex_unlock(&rs->lock);
+            break;
+        }
+        vsapi->freeFrame(f);
+    }
+
+    return NULL;
+}
+
+static int cmp_int64(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const int64_t* sorted, int count, double p)
+{
+    int i = (int)(p * (count - 1) + 0.5);
+
+    return sorted[i] / 1e6;
+}
+
+static int run(mock_plugin* plugin, const char* script, const VSFormat* format, int width, int height, int frames, int threads, int lookahead)
+{
+    const VSAPI* vsapi = mockvs_api();
+    VSMap* in = vsapi->createMap();
+    VSNodeRef* clip = mockvs_blank_clip(format, width, height, 24000, 1001, frames);
+    run_state rs = { 0 };
+    thread* pool = malloc(threads * sizeof(thread));
+    const char* name = script;
+
+    for (const char* p = script; *p; p++)
+        if (*p == '/' || *p == '\\')
+            name = p + 1;
+
+    reset_peak_rss();
+
+    vsapi->propSetNode(in, "clip", clip, paReplace);
+    vsapi->propSetData(in, "file", script, -1, paReplace);
+    vsapi->propSetInt(in, "lookahead", lookahead, paReplace);
+    vsapi->freeNode(clip);
+
+    VSMap* out = vsapi->invoke(mockvs_plugin(plugin), "TextSub", in);
+    vsapi->freeMap(in);
+
+    if (vsapi->getError(out)) {
+        fprintf(stderr, "%s %s: %s\n", name, format->name, vsapi->getError(out));
+        vsapi->freeMap(out);
+        free(pool);
+        return 0;
+    }
+
+    rs.node = vsapi->propGetNode(out, "clip", 0, NULL);
+    rs.frames = frames;
+    rs.latency = calloc(frames, sizeof(int64_t));
+    mutex_init(&rs.lock);
+    vsapi->freeMap(out);
+
+    int64_t start = monotonic_ns();
+    int started = 0;
+
+    while (started < threads && !thread_create(pool + started, worker, &rs))
+        started++;
+    for (int i = 0; i < started; i++)
+        thread_join(pool[i]);
+
+    int64_t elapsed = monotonic_ns() - start;
+
+    vsapi->freeNode(rs.node);
+
+    if (rs.error[0]) {
+        fprintf(stderr, "%s %s: %s\n", name, format->name, rs.error);
+    }
+    else {
+        qsort(rs.latency, frames, sizeof(int64_t), cmp_int64);
+        printf("%-14s %-10s %3d %9.1f %8.2f %8.2f %8.2f %8.2f %9.1f\n",
+               name, format->name, started, frames / (elapsed / 1e9),
+               percentile_ms(rs.latency, frames, 0.5), percentile_ms(rs.latency, frames, 0.9),
+               percentile_ms(rs.latency, frames, 0.99), rs.latency[frames - 1] / 1e6,
+               peak_rss() / 1048576.0);
+    }
+
+    mutex_destroy(&rs.lock);
+    free(rs.latency);
+    free(pool);
+
+    return !rs.error[0];
+}
+
+int main(int argc, char** argv)
+{
+    const char* default_formats = "YUV420P8,YUV420P10,RGB24";
+    const char* format_list = default_formats;
+    int width = 1920, height = 1080;
+    int frames = 1440;
+    int threads = cpu_count();
+    int lookahead = 0;
+    const char** scripts = calloc(argc + 1, sizeof(char*));
+    int nscripts = 0;
+    int ok = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            format_list = argv[++i];
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            lookahead = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                fprintf(stderr, "invalid size '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+            scripts[nscripts++] = argv[i];
+    }
+
+    if (threads < 1 || frames < 1 || width < 16 || height < 16) {
+        fprintf(stderr, "invalid thread, frame count or size\n");
+        return 1;
+    }
+
+    // the corpus is passed in by CMake as a '|' separated list
+    char* corpus = strdup(ASSRENDER_CORPUS);
+    if (!nscripts) {
+        scripts = realloc(scripts, (strlen(corpus) + 2) * sizeof(char*));
+        for (char* p = strtok(corpus, "|"); p; p = strtok(NULL, "|"))
+            scripts[nscripts++] = p;
+    }
+
+    mock_plugin* plugin = mockvs_load_plugin(VapourSynthPluginInit);
+
+    printf("%dx%d, %d frames at 24000/1001, lookahead %d\n", width, height, frames, lookahead);
+    printf("%-14s %-10s %3s %9s %8s %8s %8s %8s %9s\n",
+           "script", "format", "thr", "fps", "p50 ms", "p90 ms", "p99 ms", "max ms", "peak MiB");
+
+    for (int s = 0; s < nscripts; s++) {
+        char* list = strdup(format_list);
+
+        for (char* f = strtok(list, ","); f; f = strtok(NULL, ",")) {
+            const VSFormat* format = mockvs_format_by_name(f);
+
+            if (!format) {
+                fprintf(stderr, "unknown format '%s'\n", f);
+                ok = 0;
+                continue;
+            }
+            ok &= run(plugin, scripts[s], format, width, height, frames, threads, lookahead);
+        }
+
+        free(list);
+    }
+
+    mockvs_free_plugin(plugin);
+    free(corpus);
+    free(scripts);
+
+    return ok ? 0 : 1;
+}
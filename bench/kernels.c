@@ -0,0 +1,119 @@
+// Times make_sub_img / make_sub_img16 and every apply_* kernel on synthetic
+// scenes, for every format the kernels support.
+//
+//   assrender_bench [-s WIDTHxHEIGHT] [-t SECONDS] [FILTER]
+//
+// FILTER limits the run to scenes and formats whose name contains it.
+
+#include <stdio.h>
+#include "stats.h"
+#include "synth.h"
+
+static double seconds = 0.5;
+
+// runs the kernel until the time is up, returns ns per run
+typedef void (*bench_fn)(void* arg);
+
+static double run(bench_fn fn, void* arg)
+{
+    int64_t start = monotonic_ns(), elapsed;
+    int64_t runs = 0;
+
+    do {
+        fn(arg);
+        runs++;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < seconds * 1e9);
+
+    return (double)elapsed / runs;
+}
+
+typedef struct {
+    const synth_format* fmt;
+    synth_scene* scene;
+    synth_frame* frame;
+    uint8_t* sub_img[4];
+    int width, height;
+} bench_case;
+
+static void bench_make(void* arg)
+{
+    bench_case* c = arg;
+
+    synth_overlay(c->fmt, c->scene->images, c->sub_img, c->width, c->height);
+}
+
+static void bench_apply(void* arg)
+{
+    bench_case* c = arg;
+
+    c->fmt->apply(c->sub_img, c->frame->data, c->frame->pitch, c->width, c->height);
+}
+
+static void report(const char* scene, const char* format, const char* kernel, double ns, int64_t pixels)
+{
+    printf("%-10s %-10s %-8s %10.1f MPix/s %8.3f ns/px\n",
+           scene, format, kernel, pixels / ns * 1e3, ns / pixels);
+}
+
+int main(int argc, char** argv)
+{
+    int width = 1920, height = 1080;
+    const char* filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 16 || height < 16) {
+                fprintf(stderr, "invalid size '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        }
+        else {
+            filter = argv[i];
+        }
+    }
+
+    // the subsampled kernels work on whole chroma samples
+    width &= ~3;
+    height &= ~1;
+
+    printf("%dx%d, %.2f s per kernel; make is per overlay pixel, apply per frame pixel\n",
+           width, height, seconds);
+
+    for (int k = 0; k < SCENE_COUNT; k++) {
+        synth_scene scene;
+
+        if (!synth_scene_new(&scene, k, width, height)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        for (int f = 0; f < synth_format_count; f++) {
+            const synth_format* fmt = synth_formats + f;
+            synth_frame frame;
+            bench_case c = { fmt, &scene, &frame, { 0 }, width, height };
+
+            if (filter && !strstr(scene.name, filter) && !strstr(fmt->name, filter))
+                continue;
+
+            if (!synth_frame_new(&frame, fmt, width, height, 1) ||
+                !synth_sub_img_new(c.sub_img, fmt, width, height)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+
+            report(scene.name, fmt->name, "make", run(bench_make, &c), scene.area);
+            report(scene.name, fmt->name, "apply", run(bench_apply, &c), (int64_t)width * height);
+
+            synth_sub_img_free(c.sub_img);
+            synth_frame_free(&frame);
+        }
+
+        synth_scene_free(&scene);
+    }
+
+    return 0;
+}
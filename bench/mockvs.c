@@ -0,0 +1,811 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mockvs.h"
+#include "thread.h"
+
+// everything that is shared between threads: reference counts and the
+// request serialization of each node; one lock is plenty for a benchmark
+static mutex mock_lock = MUTEX_INITIALIZER;
+
+typedef struct {
+    int64_t i;
+    double f;
+    char* data;
+    int size;
+    VSNodeRef* node;
+    const VSFrameRef* frame;
+} map_value;
+
+typedef struct {
+    char* key;
+    char type;
+    map_value* values;
+    int count;
+} map_entry;
+
+struct VSMap {
+    map_entry* entries;
+    int count;
+    char* error;
+};
+
+typedef struct {
+    uint8_t* data;
+    int refs;
+} plane_buffer;
+
+struct VSFrameRef {
+    const VSFormat* format;
+    int width, height;
+    plane_buffer* planes[3];
+    int stride[3];
+    VSMap* props;
+};
+
+struct VSNodeRef {
+    int refs;
+    VSVideoInfo vi;
+    // a blank source clip, or a filter
+    const VSFrameRef* blank;
+    VSFilterGetFrame get_frame;
+    VSFilterFree free;
+    void* instance;
+    int mode;
+    mutex serial;
+};
+
+struct VSFrameContext {
+    char error[512];
+};
+
+typedef struct {
+    char* name;
+    VSPublicFunction func;
+    void* data;
+} plugin_function;
+
+struct mock_plugin {
+    plugin_function* functions;
+    int count;
+};
+
+static const VSAPI api;
+static int core_dummy;
+
+// --- maps
+
+static map_entry* find_entry(const VSMap* map, const char* key)
+{
+    for (int i = 0; i < map->count; i++)
+        if (!strcmp(map->entries[i].key, key))
+            return map->entries + i;
+    return NULL;
+}
+
+static void free_value(char type, map_value* v)
+{
+    if (type == ptData)
+        free(v->data);
+    else if (type == ptNode)
+        api.freeNode(v->node);
+    else if (type == ptFrame)
+        api.freeFrame(v->frame);
+}
+
+static void clear_entry(map_entry* e)
+{
+    for (int i = 0; i < e->count; i++)
+        free_value(e->type, e->values + i);
+    free(e->values);
+    e->values = NULL;
+    e->count = 0;
+}
+
+// the slot for a new value, NULL if the key holds another type
+static map_value* set_value(VSMap* map, const char* key, char type, int append)
+{
+    map_entry* e = find_entry(map, key);
+
+    if (!e) {
+        map->entries = realloc(map->entries, (map->count + 1) * sizeof(map_entry));
+        e = map->entries + map->count++;
+        e->key = strdup(key);
+        e->type = type;
+        e->values = NULL;
+        e->count = 0;
+    }
+    else if (append == paReplace) {
+        clear_entry(e);
+        e->type = type;
+    }
+    else if (e->type != type) {
+        return NULL;
+    }
+
+    e->values = realloc(e->values, (e->count + 1) * sizeof(map_value));
+    memset(e->values + e->count, 0, sizeof(map_value));
+
+    return e->values + e->count++;
+}
+
+static const map_value* get_value(const VSMap* map, const char* key, int index, char type, int* error)
+{
+    const map_entry* e = find_entry(map, key);
+    int err = 0;
+
+    if (!e)
+        err = peUnset;
+    else if (e->type != type)
+        err = peType;
+    else if (index < 0 || index >= e->count)
+        err = peIndex;
+
+    if (error)
+        *error = err;
+    else if (err) {
+        fprintf(stderr, "mockvs: property read error on key '%s'\n", key);
+        abort();
+    }
+
+    return err ? NULL : e->values + index;
+}
+
+static VSMap* VS_CC createMap(void)
+{
+    return calloc(1, sizeof(VSMap));
+}
+
+static void VS_CC clearMap(VSMap* map)
+{
+    for (int i = 0; i < map->count; i++) {
+        clear_entry(map->entries + i);
+        free(map->entries[i].key);
+    }
+    free(map->entries);
+    free(map->error);
+    map->entries = NULL;
+    map->count = 0;
+    map->error = NULL;
+}
+
+static void VS_CC freeMap(VSMap* map)
+{
+    if (!map)
+        return;
+    clearMap(map);
+    free(map);
+}
+
+static void VS_CC setError(VSMap* map, const char* message)
+{
+    clearMap(map);
+    map->error = strdup(message ? message : "Error: no error specified");
+}
+
+static const char* VS_CC getError(const VSMap* map)
+{
+    return map->error;
+}
+
+static int VS_CC propNumKeys(const VSMap* map)
+{
+    return map->count;
+}
+
+static const char* VS_CC propGetKey(const VSMap* map, int index)
+{
+    return index >= 0 && index < map->count ? map->entries[index].key : NULL;
+}
+
+static int VS_CC propNumElements(const VSMap* map, const char* key)
+{
+    const map_entry* e = find_entry(map, key);
+
+    return e ? e->count : -1;
+}
+
+static char VS_CC propGetType(const VSMap* map, const char* key)
+{
+    const map_entry* e = find_entry(map, key);
+
+    return e ? e->type : ptUnset;
+}
+
+static int64_t VS_CC propGetInt(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptInt, error);
+
+    return v ? v->i : 0;
+}
+
+static double VS_CC propGetFloat(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptFloat, error);
+
+    return v ? v->f : 0;
+}
+
+static const char* VS_CC propGetData(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptData, error);
+
+    return v ? v->data : NULL;
+}
+
+static int VS_CC propGetDataSize(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptData, error);
+
+    return v ? v->size : -1;
+}
+
+static VSNodeRef* VS_CC propGetNode(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptNode, error);
+
+    return v ? api.cloneNodeRef(v->node) : NULL;
+}
+
+static const VSFrameRef* VS_CC propGetFrame(const VSMap* map, const char* key, int index, int* error)
+{
+    const map_value* v = get_value(map, key, index, ptFrame, error);
+
+    return v ? api.cloneFrameRef(v->frame) : NULL;
+}
+
+static int VS_CC propDeleteKey(VSMap* map, const char* key)
+{
+    map_entry* e = find_entry(map, key);
+
+    if (!e)
+        return 0;
+
+    clear_entry(e);
+    free(e->key);
+    *e = map->entries[--map->count];
+
+    return 1;
+}
+
+static int VS_CC propSetInt(VSMap* map, const char* key, int64_t i, int append)
+{
+    map_value* v = set_value(map, key, ptInt, append);
+
+    if (!v)
+        return 1;
+    v->i = i;
+
+    return 0;
+}
+
+static int VS_CC propSetFloat(VSMap* map, const char* key, double d, int append)
+{
+    map_value* v = set_value(map, key, ptFloat, append);
+
+    if (!v)
+        return 1;
+    v->f = d;
+
+    return 0;
+}
+
+static int VS_CC propSetData(VSMap* map, const char* key, const char* data, int size, int append)
+{
+    map_value* v = set_value(map, key, ptData, append);
+
+    if (!v)
+        return 1;
+    if (size < 0)
+        size = (int)strlen(data);
+    v->data = malloc(size + 1);
+    memcpy(v->data, data, size);
+    v->data[size] = 0;
+    v->size = size;
+
+    return 0;
+}
+
+static int VS_CC propSetNode(VSMap* map, const char* key, VSNodeRef* node, int append)
+{
+    map_value* v = set_value(map, key, ptNode, append);
+
+    if (!v)
+        return 1;
+    v->node = api.cloneNodeRef(node);
+
+    return 0;
+}
+
+static int VS_CC propSetFrame(VSMap* map, const char* key, const VSFrameRef* f, int append)
+{
+    map_value* v = set_value(map, key, ptFrame, append);
+
+    if (!v)
+        return 1;
+    v->frame = api.cloneFrameRef(f);
+
+    return 0;
+}
+
+static void copy_map(VSMap* dst, const VSMap* src)
+{
+    for (int i = 0; i < src->count; i++) {
+        const map_entry* e = src->entries + i;
+
+        for (int k = 0; k < e->count; k++) {
+            const map_value* v = e->values + k;
+
+            switch (e->type) {
+            case ptInt: propSetInt(dst, e->key, v->i, paAppend); break;
+            case ptFloat: propSetFloat(dst, e->key, v->f, paAppend); break;
+            case ptData: propSetData(dst, e->key, v->data, v->size, paAppend); break;
+            case ptNode: propSetNode(dst, e->key, v->node, paAppend); break;
+            case ptFrame: propSetFrame(dst, e->key, v->frame, paAppend); break;
+            }
+        }
+    }
+}
+
+// --- formats
+
+static const VSFormat formats[] = {
+    { "Gray8", pfGray8, cmGray, stInteger, 8, 1, 0, 0, 1 },
+    { "Gray16", pfGray16, cmGray, stInteger, 16, 2, 0, 0, 1 },
+    { "YUV420P8", pfYUV420P8, cmYUV, stInteger, 8, 1, 1, 1, 3 },
+    { "YUV422P8", pfYUV422P8, cmYUV, stInteger, 8, 1, 1, 0, 3 },
+    { "YUV444P8", pfYUV444P8, cmYUV, stInteger, 8, 1, 0, 0, 3 },
+    { "YUV420P10", pfYUV420P10, cmYUV, stInteger, 10, 2, 1, 1, 3 },
+    { "YUV422P10", pfYUV422P10, cmYUV, stInteger, 10, 2, 1, 0, 3 },
+    { "YUV444P10", pfYUV444P10, cmYUV, stInteger, 10, 2, 0, 0, 3 },
+    { "YUV420P12", pfYUV420P12, cmYUV, stInteger, 12, 2, 1, 1, 3 },
+    { "YUV422P12", pfYUV422P12, cmYUV, stInteger, 12, 2, 1, 0, 3 },
+    { "YUV444P12", pfYUV444P12, cmYUV, stInteger, 12, 2, 0, 0, 3 },
+    { "YUV420P16", pfYUV420P16, cmYUV, stInteger, 16, 2, 1, 1, 3 },
+    { "YUV422P16", pfYUV422P16, cmYUV, stInteger, 16, 2, 1, 0, 3 },
+    { "YUV444P16", pfYUV444P16, cmYUV, stInteger, 16, 2, 0, 0, 3 },
+    { "RGB24", pfRGB24, cmRGB, stInteger, 8, 1, 0, 0, 3 },
+    { "RGB48", pfRGB48, cmRGB, stInteger, 16, 2, 0, 0, 3 },
+};
+
+const VSFormat* mockvs_format(int id)
+{
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        if (formats[i].id == id)
+            return formats + i;
+    return NULL;
+}
+
+const VSFormat* mockvs_format_by_name(const char* name)
+{
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        const char* a = formats[i].name;
+        const char* b = name;
+
+        while (*a && *b && (*a | 0x20) == (*b | 0x20)) {
+            a++;
+            b++;
+        }
+        if (!*a && !*b)
+            return formats + i;
+    }
+    return NULL;
+}
+
+static const VSFormat* VS_CC getFormatPreset(int id, VSCore* core)
+{
+    return mockvs_format(id);
+}
+
+// --- frames
+
+static plane_buffer* new_plane(size_t size)
+{
+    plane_buffer* p = malloc(sizeof(plane_buffer));
+
+    p->data = malloc(size);
+    p->refs = 1;
+
+    return p;
+}
+
+static void release_plane(plane_buffer* p)
+{
+    int refs;
+
+    if (!p)
+        return;
+
+    mutex_lock(&mock_lock);
+    refs = --p->refs;
+    mutex_unlock(&mock_lock);
+
+    if (!refs) {
+        free(p->data);
+        free(p);
+    }
+}
+
+static VSFrameRef* VS_CC newVideoFrame(const VSFormat* format, int width, int height, const VSFrameRef* propSrc, VSCore* core)
+{
+    VSFrameRef* f = calloc(1, sizeof(VSFrameRef));
+
+    f->format = format;
+    f->width = width;
+    f->height = height;
+    f->props = createMap();
+
+    for (int i = 0; i < format->numPlanes; i++) {
+        int w = i ? width >> format->subSamplingW : width;
+        int h = i ? height >> format->subSamplingH : height;
+
+        // 64 byte aligned rows, like the core
+        f->stride[i] = (w * format->bytesPerSample + 63) & ~63;
+        f->planes[i] = new_plane((size_t)f->stride[i] * h);
+    }
+
+    if (propSrc)
+        copy_map(f->props, propSrc->props);
+
+    return f;
+}
+
+static VSFrameRef* VS_CC copyFrame(const VSFrameRef* src, VSCore* core)
+{
+    VSFrameRef* f = calloc(1, sizeof(VSFrameRef));
+
+    *f = *src;
+    f->props = createMap();
+    copy_map(f->props, src->props);
+
+    mutex_lock(&mock_lock);
+    for (int i = 0; i < src->format->numPlanes; i++)
+        f->planes[i]->refs++;
+    mutex_unlock(&mock_lock);
+
+    return f;
+}
+
+static const VSFrameRef* VS_CC cloneFrameRef(const VSFrameRef* f)
+{
+    return copyFrame(f, NULL);
+}
+
+static void VS_CC freeFrame(const VSFrameRef* f)
+{
+    if (!f)
+        return;
+
+    for (int i = 0; i < 3; i++)
+        release_plane(f->planes[i]);
+    freeMap(f->props);
+    free((VSFrameRef*)f);
+}
+
+static int VS_CC getStride(const VSFrameRef* f, int plane)
+{
+    return f->stride[plane];
+}
+
+static const uint8_t* VS_CC getReadPtr(const VSFrameRef* f, int plane)
+{
+    return f->planes[plane]->data;
+}
+
+static uint8_t* VS_CC getWritePtr(VSFrameRef* f, int plane)
+{
+    plane_buffer* p = f->planes[plane];
+    int shared;
+
+    mutex_lock(&mock_lock);
+    shared = p->refs > 1;
+    mutex_unlock(&mock_lock);
+
+    // copy on write
+    if (shared) {
+        int h = plane ? f->height >> f->format->subSamplingH : f->height;
+        size_t size = (size_t)f->stride[plane] * h;
+
+        f->planes[plane] = new_plane(size);
+        memcpy(f->planes[plane]->data, p->data, size);
+        release_plane(p);
+    }
+
+    return f->planes[plane]->data;
+}
+
+static const VSFormat* VS_CC getFrameFormat(const VSFrameRef* f)
+{
+    return f->format;
+}
+
+static int VS_CC getFrameWidth(const VSFrameRef* f, int plane)
+{
+    return plane ? f->width >> f->format->subSamplingW : f->width;
+}
+
+static int VS_CC getFrameHeight(const VSFrameRef* f, int plane)
+{
+    return plane ? f->height >> f->format->subSamplingH : f->height;
+}
+
+static const VSMap* VS_CC getFramePropsRO(const VSFrameRef* f)
+{
+    return f->props;
+}
+
+static VSMap* VS_CC getFramePropsRW(VSFrameRef* f)
+{
+    return f->props;
+}
+
+// --- nodes
+
+static VSNodeRef* VS_CC cloneNodeRef(VSNodeRef* node)
+{
+    mutex_lock(&mock_lock);
+    node->refs++;
+    mutex_unlock(&mock_lock);
+
+    return node;
+}
+
+static void VS_CC freeNode(VSNodeRef* node)
+{
+    int refs;
+
+    if (!node)
+        return;
+
+    mutex_lock(&mock_lock);
+    refs = --node->refs;
+    mutex_unlock(&mock_lock);
+
+    if (refs)
+        return;
+
+    if (node->free)
+        node->free(node->instance, mockvs_core(), &api);
+    freeFrame(node->blank);
+    mutex_destroy(&node->serial);
+    free(node);
+}
+
+static const VSVideoInfo* VS_CC getVideoInfo(VSNodeRef* node)
+{
+    return &node->vi;
+}
+
+static void VS_CC setVideoInfo(const VSVideoInfo* vi, int numOutputs, VSNode* node)
+{
+    ((VSNodeRef*)node)->vi = *vi;
+}
+
+static VSNodeRef* new_node(void)
+{
+    VSNodeRef* node = calloc(1, sizeof(VSNodeRef));
+
+    node->refs = 1;
+    mutex_init(&node->serial);
+
+    return node;
+}
+
+VSNodeRef* mockvs_blank_clip(const VSFormat* format, int width, int height, int64_t fps_num, int64_t fps_den, int frames)
+{
+    VSNodeRef* node = new_node();
+    VSFrameRef* blank = newVideoFrame(format, width, height, NULL, NULL);
+
+    node->vi.format = format;
+    node->vi.width = width;
+    node->vi.height = height;
+    node->vi.fpsNum = fps_num;
+    node->vi.fpsDen = fps_den;
+    node->vi.numFrames = frames;
+
+    // black in the format's range
+    for (int i = 0; i < format->numPlanes; i++) {
+        int h = i ? height >> format->subSamplingH : height;
+        int w = i ? width >> format->subSamplingW : width;
+        int v = format->colorFamily == cmYUV && i ? 1 << (format->bitsPerSample - 1) : 0;
+        uint8_t* p = blank->planes[i]->data;
+
+        for (int y = 0; y < h; y++, p += blank->stride[i])
+            for (int x = 0; x < w; x++)
+                if (format->bytesPerSample == 2)
+                    ((uint16_t*)p)[x] = v;
+                else
+                    p[x] = v;
+    }
+
+    propSetInt(blank->props, "_DurationNum", fps_den, paReplace);
+    propSetInt(blank->props, "_DurationDen", fps_num, paReplace);
+    node->blank = blank;
+
+    return node;
+}
+
+static void VS_CC createFilter(const VSMap* in, VSMap* out, const char* name, VSFilterInit init, VSFilterGetFrame getFrame, VSFilterFree free, int filterMode, int flags, void* instanceData, VSCore* core)
+{
+    VSNodeRef* node = new_node();
+
+    node->get_frame = getFrame;
+    node->free = free;
+    node->instance = instanceData;
+    node->mode = filterMode;
+
+    init((VSMap*)in, out, &node->instance, (VSNode*)node, core, &api);
+
+    if (getError(out)) {
+        // the filter already failed, the core doesn't call its free then
+        node->free = NULL;
+        freeNode(node);
+        return;
+    }
+
+    propSetNode(out, "clip", node, paReplace);
+    freeNode(node);
+}
+
+static void VS_CC setFilterError(const char* message, VSFrameContext* ctx)
+{
+    snprintf(ctx->error, sizeof(ctx->error), "%s", message);
+}
+
+const VSFrameRef* mockvs_get_frame(VSNodeRef* node, int n, char* error, int size)
+{
+    VSFrameContext ctx = { { 0 } };
+    void* frame_data = NULL;
+    const VSFrameRef* f;
+    int serial = node->mode != fmParallel;
+
+    // a source hands out references to the same blank planes
+    if (node->blank)
+        return copyFrame(node->blank, NULL);
+
+    // the unordered and serial modes also serialize arInitial
+    if (node->mode == fmUnordered || node->mode == fmSerial)
+        mutex_lock(&node->serial);
+    node->get_frame(n, arInitial, &node->instance, &frame_data, &ctx, mockvs_core(), &api);
+    if (node->mode == fmUnordered || node->mode == fmSerial)
+        mutex_unlock(&node->serial);
+
+    // requested frames are made on demand in getFrameFilter
+    if (serial)
+        mutex_lock(&node->serial);
+    f = ctx.error[0] ? NULL :
+        node->get_frame(n, arAllFramesReady, &node->instance, &frame_data, &ctx, mockvs_core(), &api);
+    if (serial)
+        mutex_unlock(&node->serial);
+
+    if (!f && error)
+        snprintf(error, size, "%s", ctx.error[0] ? ctx.error : "mockvs: filter returned no frame");
+
+    return f;
+}
+
+static void VS_CC requestFrameFilter(int n, VSNodeRef* node, VSFrameContext* ctx)
+{
+}
+
+static const VSFrameRef* VS_CC getFrameFilter(int n, VSNodeRef* node, VSFrameContext* ctx)
+{
+    if (n >= node->vi.numFrames)
+        n = node->vi.numFrames - 1;
+
+    return mockvs_get_frame(node, n, ctx->error, sizeof(ctx->error));
+}
+
+// --- plugins
+
+static void VS_CC configPlugin(const char* identifier, const char* defaultNamespace, const char* name, int apiVersion, int readonly, VSPlugin* plugin)
+{
+}
+
+static void VS_CC registerFunction(const char* name, const char* args, VSPublicFunction argsFunc, void* functionData, VSPlugin* plugin)
+{
+    mock_plugin* p = (mock_plugin*)plugin;
+
+    p->functions = realloc(p->functions, (p->count + 1) * sizeof(plugin_function));
+    p->functions[p->count].name = strdup(name);
+    p->functions[p->count].func = argsFunc;
+    p->functions[p->count].data = functionData;
+    p->count++;
+}
+
+mock_plugin* mockvs_load_plugin(VSInitPlugin init)
+{
+    mock_plugin* p = calloc(1, sizeof(mock_plugin));
+
+    init(configPlugin, registerFunction, (VSPlugin*)p);
+
+    return p;
+}
+
+void mockvs_free_plugin(mock_plugin* plugin)
+{
+    for (int i = 0; i < plugin->count; i++)
+        free(plugin->functions[i].name);
+    free(plugin->functions);
+    free(plugin);
+}
+
+VSPlugin* mockvs_plugin(mock_plugin* plugin)
+{
+    return (VSPlugin*)plugin;
+}
+
+static VSMap* VS_CC invoke(VSPlugin* plugin, const char* name, const VSMap* args)
+{
+    mock_plugin* p = (mock_plugin*)plugin;
+    VSMap* out = createMap();
+
+    for (int i = 0; i < p->count; i++) {
+        if (!strcmp(p->functions[i].name, name)) {
+            p->functions[i].func(args, out, p->functions[i].data, mockvs_core(), &api);
+            return out;
+        }
+    }
+
+    setError(out, "mockvs: no such function");
+
+    return out;
+}
+
+VSCore* mockvs_core(void)
+{
+    return (VSCore*)&core_dummy;
+}
+
+// filled in at compile time, so every thread can fetch it
+static const VSAPI api = {
+    .cloneFrameRef = cloneFrameRef,
+    .cloneNodeRef = cloneNodeRef,
+    .freeFrame = freeFrame,
+    .freeNode = freeNode,
+    .newVideoFrame = newVideoFrame,
+    .copyFrame = copyFrame,
+    .registerFunction = registerFunction,
+    .createFilter = createFilter,
+    .setError = setError,
+    .getError = getError,
+    .setFilterError = setFilterError,
+    .invoke = invoke,
+    .getFormatPreset = getFormatPreset,
+    .getFrameFilter = getFrameFilter,
+    .requestFrameFilter = requestFrameFilter,
+    .getStride = getStride,
+    .getReadPtr = getReadPtr,
+    .getWritePtr = getWritePtr,
+    .createMap = createMap,
+    .freeMap = freeMap,
+    .clearMap = clearMap,
+    .getVideoInfo = getVideoInfo,
+    .setVideoInfo = setVideoInfo,
+    .getFrameFormat = getFrameFormat,
+    .getFrameWidth = getFrameWidth,
+    .getFrameHeight = getFrameHeight,
+    .getFramePropsRO = getFramePropsRO,
+    .getFramePropsRW = getFramePropsRW,
+    .propNumKeys = propNumKeys,
+    .propGetKey = propGetKey,
+    .propNumElements = propNumElements,
+    .propGetType = propGetType,
+    .propGetInt = propGetInt,
+    .propGetFloat = propGetFloat,
+    .propGetData = propGetData,
+    .propGetDataSize = propGetDataSize,
+    .propGetNode = propGetNode,
+    .propGetFrame = propGetFrame,
+    .propDeleteKey = propDeleteKey,
+    .propSetInt = propSetInt,
+    .propSetFloat = propSetFloat,
+    .propSetData = propSetData,
+    .propSetNode = propSetNode,
+    .propSetFrame = propSetFrame,
+};
+
+const VSAPI* mockvs_api(void)
+{
+    return &api;
+}
@@ -0,0 +1,34 @@
+#ifndef _MOCKVS_H_
+#define _MOCKVS_H_
+
+#include "VapourSynth.h"
+
+// A minimal in-process stand-in for the VapourSynth API 3 core: property
+// maps, copy-on-write frames, blank source clips and filter nodes. It loads
+// a plugin through its init function and requests frames the way the core
+// does, including the serialization of the non-parallel filter modes, so
+// the plugin can be benchmarked and tested without a VapourSynth install.
+
+typedef struct mock_plugin mock_plugin;
+
+const VSAPI* mockvs_api(void);
+VSCore* mockvs_core(void);
+
+// preset formats only; NULL if the id isn't one
+const VSFormat* mockvs_format(int id);
+// by VapourSynth name, e.g. "YUV420P10"; case doesn't matter
+const VSFormat* mockvs_format_by_name(const char* name);
+
+mock_plugin* mockvs_load_plugin(VSInitPlugin init);
+void mockvs_free_plugin(mock_plugin* plugin);
+VSPlugin* mockvs_plugin(mock_plugin* plugin);
+
+// a clip of blank frames, as std.BlankClip would give
+VSNodeRef* mockvs_blank_clip(const VSFormat* format, int width, int height, int64_t fps_num, int64_t fps_den, int frames);
+
+// requests frame n like an output node of the core does: arInitial, then
+// arAllFramesReady once the requested frames are there; NULL on error,
+// with the message in error
+const VSFrameRef* mockvs_get_frame(VSNodeRef* node, int n, char* error, int size);
+
+#endif
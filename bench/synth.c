@@ -0,0 +1,309 @@
+#include "synth.h"
+
+const synth_format synth_formats[] = {
+    // planar, as the VapourSynth filter uses them
+    { "yuv420p8",  apply_yv12,   8, 1, 1, 0, 0, 0 },
+    { "yuv420p10", apply_yuv420, 10, 1, 1, 0, 0, 0 },
+    { "yuv420p16", apply_yuv420, 16, 1, 1, 0, 0, 0 },
+    { "yuv422p8",  apply_yv16,   8, 1, 0, 0, 0, 0 },
+    { "yuv422p10", apply_yuv422, 10, 1, 0, 0, 0, 0 },
+    { "yuv422p16", apply_yuv422, 16, 1, 0, 0, 0, 0 },
+    { "yuv444p8",  apply_yv24,   8, 0, 0, 0, 0, 0 },
+    { "yuv444p10", apply_yuv444, 10, 0, 0, 0, 0, 0 },
+    { "yuv444p16", apply_yuv444, 16, 0, 0, 0, 0, 0 },
+    { "rgb24",     apply_yv24,   8, 0, 0, 0, 1, 0 },
+    { "rgb48",     apply_yuv444, 16, 0, 0, 0, 1, 0 },
+    { "gray8",     apply_y8,     8, 0, 0, 0, 0, 1 },
+    { "gray16",    apply_y,      16, 0, 0, 0, 0, 1 },
+    // the remaining kernels, reachable through csri and older entry points
+    { "yv411",     apply_yv411,  8, 2, 0, 0, 0, 0 },
+    { "yuy2",      apply_yuy2,   8, 0, 0, 2, 0, 0 },
+    { "bgr24",     apply_rgb,    8, 0, 0, 3, 1, 0 },
+    { "bgr32",     apply_rgb32,  8, 0, 0, 4, 1, 0 },
+    { "bgra",      apply_rgba,   8, 0, 0, 4, 1, 0 },
+    { "bgr48",     apply_rgb48,  16, 0, 0, 3, 1, 0 },
+    { "bgra64",    apply_rgb64,  16, 0, 0, 4, 1, 0 },
+};
+
+const int synth_format_count = sizeof(synth_formats) / sizeof(synth_formats[0]);
+
+static uint32_t next_random(uint32_t* state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// an antialiased ellipse with a few darker stripes, roughly the coverage of a glyph
+static void glyph_bitmap(uint8_t* b, int w, int h, int stride, uint32_t seed)
+{
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int dx = 2 * x + 1 - w;
+            int dy = 2 * y + 1 - h;
+            int d = dx * dx * 256 / (w * w) + dy * dy * 256 / (h * h);
+            int v = d < 160 ? 255 : d < 256 ? (256 - d) * 255 / 96 : 0;
+
+            if ((x + seed) % 5 == 0)
+                v /= 2;
+            b[y * stride + x] = v;
+        }
+        memset(b + y * stride + w, 0, stride - w);
+    }
+}
+
+static void gradient_bitmap(uint8_t* b, int w, int h, int stride)
+{
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < stride; x++)
+            b[y * stride + x] = x < w ? (x + y) & 0xFF : 0;
+}
+
+typedef struct {
+    synth_scene* s;
+    size_t used, cap;
+    int width, height;
+} scene_builder;
+
+// reserves an image and its bitmap, clipped to the frame; NULL if nothing is left
+static ASS_Image* add_image(scene_builder* sb, int x, int y, int w, int h, uint32_t color)
+{
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > sb->width) w = sb->width - x;
+    if (y + h > sb->height) h = sb->height - y;
+    if (w <= 0 || h <= 0)
+        return NULL;
+
+    int stride = (w + 15) & ~15;
+    ASS_Image* img = sb->s->images + sb->s->count++;
+
+    img->w = w;
+    img->h = h;
+    img->stride = stride;
+    img->dst_x = x;
+    img->dst_y = y;
+    img->color = color;
+    img->bitmap = sb->s->bitmaps + sb->used;
+    img->next = NULL;
+    img->type = IMAGE_TYPE_CHARACTER;
+
+    sb->used += (size_t)stride * h;
+    sb->s->area += (int64_t)w * h;
+
+    return img;
+}
+
+static void add_glyph(scene_builder* sb, int x, int y, int w, int h, uint32_t fill, int highlight, uint32_t seed)
+{
+    ASS_Image* img;
+    int border = w / 10 + 1;
+
+    if ((img = add_image(sb, x + border, y + border, w, h, 0x00000080)) != NULL) {
+        img->type = IMAGE_TYPE_SHADOW;
+        glyph_bitmap(img->bitmap, img->w, img->h, img->stride, seed);
+    }
+    if ((img = add_image(sb, x - border, y - border, w + 2 * border, h + 2 * border, 0x00000000)) != NULL) {
+        img->type = IMAGE_TYPE_OUTLINE;
+        glyph_bitmap(img->bitmap, img->w, img->h, img->stride, seed);
+    }
+    if ((img = add_image(sb, x, y, w, h, fill)) != NULL)
+        glyph_bitmap(img->bitmap, img->w, img->h, img->stride, seed);
+    // karaoke: the sung part of the syllable over the unsung fill
+    if (highlight && (img = add_image(sb, x, y, w / 2 + 1, h, 0xFFD70000)) != NULL)
+        glyph_bitmap(img->bitmap, img->w, img->h, img->stride, seed + 1);
+}
+
+static void add_lines(scene_builder* sb, int lines, int glyphs, int top, int gw, int gh, int highlight)
+{
+    int advance = gw + gw / 4;
+    int left = (sb->width - glyphs * advance) / 2;
+
+    for (int l = 0; l < lines; l++)
+        for (int g = 0; g < glyphs; g++)
+            add_glyph(sb, left + g * advance, top + l * gh * 5 / 4, gw, gh,
+                      l & 1 ? 0xFFFF0000 : 0xFFFFFF00, highlight && g < glyphs / 2, l * glyphs + g);
+}
+
+int synth_scene_new(synth_scene* s, int kind, int width, int height)
+{
+    static const char* const names[SCENE_COUNT] = { "dialogue", "karaoke", "signs" };
+    scene_builder sb = { s, 0, 0, width, height };
+    int gw = width / 68 > 4 ? width / 68 : 4;
+    int gh = height / 27 > 6 ? height / 27 : 6;
+    int nimages;
+
+    memset(s, 0, sizeof(synth_scene));
+    s->name = names[kind];
+
+    switch (kind) {
+    case SCENE_DIALOGUE:
+        nimages = 2 * 40 * 3;
+        break;
+    case SCENE_KARAOKE:
+        nimages = 14 * 50 * 4;
+        break;
+    default:
+        nimages = 3;
+    }
+
+    // bitmaps are never bigger than the frame plus borders and stride padding
+    sb.cap = (size_t)nimages * ((gw + 2 * (gw / 10 + 1) + 16) * (gh + 2 * (gh / 10 + 1)));
+    if (kind == SCENE_SIGNS)
+        sb.cap = (size_t)3 * (width + 16) * height;
+
+    s->images = calloc(nimages, sizeof(ASS_Image));
+    s->bitmaps = malloc(sb.cap);
+    if (!s->images || !s->bitmaps) {
+        synth_scene_free(s);
+        return 0;
+    }
+
+    switch (kind) {
+    case SCENE_DIALOGUE:
+        add_lines(&sb, 2, 40, height - 4 * gh, gw, gh, 0);
+        break;
+    case SCENE_KARAOKE:
+        add_lines(&sb, 14, 50, gh, gw, gh, 1);
+        break;
+    default: {
+        ASS_Image* img;
+
+        if ((img = add_image(&sb, 0, 0, width, height, 0x20408060)) != NULL)
+            gradient_bitmap(img->bitmap, img->w, img->h, img->stride);
+        if ((img = add_image(&sb, width / 5, height / 5, width * 3 / 5, height * 3 / 5, 0xF0F0F000)) != NULL)
+            glyph_bitmap(img->bitmap, img->w, img->h, img->stride, 0);
+        if ((img = add_image(&sb, width / 3, height / 2, width / 2, height / 3, 0xC0102040)) != NULL)
+            gradient_bitmap(img->bitmap, img->w, img->h, img->stride);
+    }
+    }
+
+    for (int i = 0; i + 1 < s->count; i++)
+        s->images[i].next = s->images + i + 1;
+
+    return 1;
+}
+
+void synth_scene_free(synth_scene* s)
+{
+    free(s->images);
+    free(s->bitmaps);
+    memset(s, 0, sizeof(synth_scene));
+}
+
+size_t synth_frame_size(const synth_frame* f, int plane)
+{
+    return (size_t)f->pitch[plane] * f->height;
+}
+
+int synth_frame_new(synth_frame* f, const synth_format* fmt, int width, int height, uint32_t seed)
+{
+    int bytes = fmt->bits > 8 ? 2 : 1;
+    uint32_t state = seed ? seed : 1;
+
+    memset(f, 0, sizeof(synth_frame));
+    f->width = width;
+    f->height = height;
+    f->planes = fmt->packed || fmt->greyscale ? 1 : 3;
+
+    for (int i = 0; i < f->planes; i++) {
+        int w = fmt->packed ? width * fmt->packed : i ? width >> fmt->ssw : width;
+        int h = i ? height >> fmt->ssh : height;
+
+        // 64 bytes of padding, the kernels must not touch it
+        f->pitch[i] = w * bytes + 64;
+        f->data[i] = malloc((size_t)f->pitch[i] * h);
+        if (!f->data[i]) {
+            synth_frame_free(f);
+            return 0;
+        }
+
+        for (size_t b = 0; b < (size_t)f->pitch[i] * h; b++)
+            f->data[i][b] = next_random(&state) >> 24;
+        if (bytes == 2)
+            for (size_t b = 0; b < (size_t)f->pitch[i] * h / 2; b++)
+                ((uint16_t*)f->data[i])[b] &= (1 << fmt->bits) - 1;
+    }
+
+    return 1;
+}
+
+void synth_frame_free(synth_frame* f)
+{
+    for (int i = 0; i < 3; i++)
+        free(f->data[i]);
+    memset(f, 0, sizeof(synth_frame));
+}
+
+int synth_sub_img_new(uint8_t** sub_img, const synth_format* fmt, int width, int height)
+{
+    size_t size = (size_t)width * height * (fmt->bits > 8 ? 2 : 1);
+
+    for (int i = 0; i < 4; i++) {
+        sub_img[i] = malloc(size);
+        if (!sub_img[i]) {
+            synth_sub_img_free(sub_img);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void synth_sub_img_free(uint8_t** sub_img)
+{
+    for (int i = 0; i < 4; i++) {
+        free(sub_img[i]);
+        sub_img[i] = NULL;
+    }
+}
+
+void synth_overlay(const synth_format* fmt, ASS_Image* img, uint8_t** sub_img, int width, int height)
+{
+    synth_overlay_box(fmt, img, sub_img, 0, 0, width, height);
+}
+
+int synth_bbox(const synth_format* fmt, const ASS_Image* img, int width, int height, int* x, int* y, int* w, int* h)
+{
+    int x0 = width, y0 = height, x1 = 0, y1 = 0;
+
+    for (; img; img = img->next) {
+        if (img->w == 0 || img->h == 0)
+            continue;
+        if (img->dst_x < x0) x0 = img->dst_x;
+        if (img->dst_y < y0) y0 = img->dst_y;
+        if (img->dst_x + img->w > x1) x1 = img->dst_x + img->w;
+        if (img->dst_y + img->h > y1) y1 = img->dst_y + img->h;
+    }
+
+    if (x1 <= x0 || y1 <= y0)
+        return 0;
+
+    // aligned to the chroma subsampling, as render.c does
+    x0 &= ~((1 << fmt->ssw) - 1);
+    y0 &= ~((1 << fmt->ssh) - 1);
+    x1 = (x1 + (1 << fmt->ssw) - 1) & ~((1 << fmt->ssw) - 1);
+    y1 = (y1 + (1 << fmt->ssh) - 1) & ~((1 << fmt->ssh) - 1);
+
+    *x = x0;
+    *y = y0;
+    *w = (x1 < width ? x1 : width) - x0;
+    *h = (y1 < height ? y1 : height) - y0;
+
+    return 1;
+}
+
+void synth_overlay_box(const synth_format* fmt, ASS_Image* img, uint8_t** sub_img, int x, int y, int width, int height)
+{
+    ConversionMatrix mx;
+
+    FillMatrix(&mx, fmt->rgb ? MATRIX_NONE : MATRIX_BT709);
+    memset(sub_img[0], 0, (size_t)width * height * (fmt->bits > 8 ? 2 : 1));
+
+    if (fmt->bits > 8)
+        make_sub_img16(img, sub_img, width, x, y, fmt->bits, fmt->rgb, &mx);
+    else
+        make_sub_img(img, sub_img, width, x, y, fmt->bits, fmt->rgb, &mx);
+}
@@ -0,0 +1,67 @@
+#ifndef _SYNTH_H_
+#define _SYNTH_H_
+
+#include "render.h"
+
+// Synthetic inputs for the kernel benchmarks and tests: libass-like image
+// lists and frames of every format render.c can blend into. Everything is
+// generated with integer arithmetic from fixed seeds, so the same size
+// always gives the same bytes.
+
+enum {
+    SCENE_DIALOGUE,     // two lines at the bottom, shadow + outline + fill
+    SCENE_KARAOKE,      // lines over the whole frame, plus a highlight layer
+    SCENE_SIGNS,        // a few frame sized translucent images
+    SCENE_COUNT
+};
+
+typedef struct {
+    const char* name;
+    ASS_Image* images;
+    int count;
+    int64_t area;       // pixels of all images together
+    uint8_t* bitmaps;
+} synth_scene;
+
+typedef struct {
+    const char* name;
+    fPixel apply;
+    int bits;           // per sample
+    int ssw, ssh;       // chroma subsampling of planar formats
+    int packed;         // samples per pixel of packed formats, 0 if planar
+    int rgb;
+    int greyscale;
+} synth_format;
+
+typedef struct {
+    uint8_t* data[3];
+    int32_t pitch[3];
+    int planes;
+    int width, height;
+} synth_frame;
+
+extern const synth_format synth_formats[];
+extern const int synth_format_count;
+
+int synth_scene_new(synth_scene* s, int kind, int width, int height);
+void synth_scene_free(synth_scene* s);
+
+// a frame of noise, samples within the format's bit depth
+int synth_frame_new(synth_frame* f, const synth_format* fmt, int width, int height, uint32_t seed);
+void synth_frame_free(synth_frame* f);
+size_t synth_frame_size(const synth_frame* f, int plane);
+
+// four planes of width * height samples, as get_frame allocates them
+int synth_sub_img_new(uint8_t** sub_img, const synth_format* fmt, int width, int height);
+void synth_sub_img_free(uint8_t** sub_img);
+
+// clears sub_img and runs make_sub_img / make_sub_img16 like get_frame does
+void synth_overlay(const synth_format* fmt, ASS_Image* img, uint8_t** sub_img, int width, int height);
+
+// the box get_frame composites into: around all images, aligned to the
+// chroma subsampling and clipped to the frame; 0 if there are no images
+int synth_bbox(const synth_format* fmt, const ASS_Image* img, int width, int height, int* x, int* y, int* w, int* h);
+// synth_overlay into a width * height overlay placed at x, y of the frame
+void synth_overlay_box(const synth_format* fmt, ASS_Image* img, uint8_t** sub_img, int x, int y, int width, int height);
+
+#endif
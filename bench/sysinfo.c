@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include "sysinfo.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif !defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+void reset_peak_rss(void)
+{
+#if defined(__linux__)
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+
+    if (fp) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+int64_t peak_rss(void)
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+
+    return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? (int64_t)pmc.PeakWorkingSetSize : 0;
+#elif defined(__linux__)
+    FILE* fp = fopen("/proc/self/status", "r");
+    char line[256];
+    long long kb = 0;
+
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "VmHWM: %lld kB", &kb) == 1)
+            break;
+    fclose(fp);
+
+    return kb * 1024;
+#else
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+#if defined(__APPLE__)
+    return ru.ru_maxrss;
+#else
+    return (int64_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
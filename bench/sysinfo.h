@@ -0,0 +1,11 @@
+#ifndef _SYSINFO_H_
+#define _SYSINFO_H_
+
+#include <stdint.h>
+
+// peak resident set since the last reset, in bytes; where it can't be
+// reset it is the peak of the whole process so far
+void reset_peak_rss(void);
+int64_t peak_rss(void);
+
+#endif
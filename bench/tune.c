@@ -0,0 +1,266 @@
+// Renders sample frames of a script with every combination of libass
+// hinting, shaper and cache limits, reports the throughput and memory of
+// each and suggests the fastest one whose output matches the reference
+// settings (no hinting, complex shaper, default caches).
+//
+//   assrender_tune [-s WIDTHxHEIGHT] [-n SAMPLES] [-t TOLERANCE] [-p PERCENT] SCRIPT
+//
+// Samples are runs of consecutive frames at 24000/1001 spread over the
+// events of the script, so the libass caches see playback order. A setting
+// matches when no pixel differs by more than TOLERANCE (0-255, premultiplied
+// alpha) and at most PERCENT of the overlay pixels differ at all.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+#include "stats.h"
+#include "sub.h"
+#include "sysinfo.h"
+
+#define RUNS 10
+
+typedef struct {
+    const char* name;
+    int glyphs, bitmaps_mb;
+} cache_setting;
+
+// 0 keeps the libass defaults
+static const cache_setting caches[] = {
+    { "default", 0, 0 },
+    { "small", 1000, 32 },
+    { "large", 20000, 512 },
+};
+
+static const char* hinting_names[] = { "none", "light", "normal", "native" };
+static const char* shaper_names[] = { "simple", "complex" };
+
+typedef struct {
+    udata ud;
+    ASS_Track* track;
+    uint8_t* sub_img[4];
+} tune_renderer;
+
+static int open_renderer(tune_renderer* r, const char* script, int width, int height,
+                         ASS_Hinting hinting, ASS_ShapingLevel shaper, const cache_setting* cache)
+{
+    memset(r, 0, sizeof(*r));
+
+    if (!init_ass(width, height, 1.0, 0, hinting, cache->glyphs, cache->bitmaps_mb,
+                  0, 0, 0, 0, 1, 0, 0, 0, 0, 0, "", &r->ud))
+        return 0;
+
+    ass_set_shaper(r->ud.ass_renderer, shaper);
+
+    if (!(r->track = ass_read_file(r->ud.ass_library, (char*)script, NULL)))
+        return 0;
+
+    for (int i = 0; i < 4; i++)
+        if (!(r->sub_img[i] = malloc((size_t)width * height)))
+            return 0;
+
+    return 1;
+}
+
+static void close_renderer(tune_renderer* r)
+{
+    for (int i = 0; i < 4; i++)
+        free(r->sub_img[i]);
+    if (r->track)
+        ass_free_track(r->track);
+    if (r->ud.ass_renderer)
+        ass_renderer_done(r->ud.ass_renderer);
+    if (r->ud.ass_library)
+        ass_library_done(r->ud.ass_library);
+}
+
+static void composite(tune_renderer* r, ASS_Image* img, int width, int height)
+{
+    ConversionMatrix mx;
+
+    FillMatrix(&mx, MATRIX_NONE);
+    memset(r->sub_img[0], 0, (size_t)width * height);
+    make_sub_img(img, r->sub_img, width, 0, 0, 8, 1, &mx);
+}
+
+typedef struct {
+    int max_diff;
+    int64_t differing, covered;
+} diff_stats;
+
+// compares premultiplied samples, so colour under zero alpha doesn't count
+static void compare(const tune_renderer* a, const tune_renderer* b, int width, int height, diff_stats* d)
+{
+    size_t size = (size_t)width * height;
+
+    for (size_t i = 0; i < size; i++) {
+        int aa = a->sub_img[0][i], ba = b->sub_img[0][i];
+        int diff;
+
+        if (!aa && !ba)
+            continue;
+
+        diff = abs(aa - ba);
+        for (int c = 1; c < 4; c++) {
+            int cd = abs(a->sub_img[c][i] * aa - b->sub_img[c][i] * ba) / 255;
+
+            if (cd > diff)
+                diff = cd;
+        }
+
+        d->covered++;
+        if (diff) {
+            d->differing++;
+            if (diff > d->max_diff)
+                d->max_diff = diff;
+        }
+    }
+}
+
+typedef struct {
+    int hinting, shaper, cache;
+    double fps, peak_mb, diff_percent;
+    int max_diff, match;
+} tune_result;
+
+int main(int argc, char** argv)
+{
+    int width = 1920, height = 1080;
+    int samples = 200;
+    int tolerance = 0;
+    double percent = 0;
+    const char* script = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                fprintf(stderr, "invalid size '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            tolerance = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            percent = atof(argv[++i]);
+        else
+            script = argv[i];
+    }
+
+    if (!script) {
+        fprintf(stderr, "usage: assrender_tune [-s WIDTHxHEIGHT] [-n SAMPLES] [-t TOLERANCE] [-p PERCENT] SCRIPT\n");
+        return 2;
+    }
+    if (samples < RUNS || width < 16 || height < 16 || tolerance < 0 || percent < 0) {
+        fprintf(stderr, "invalid sample count, size or tolerance\n");
+        return 2;
+    }
+
+    tune_renderer ref;
+
+    if (!open_renderer(&ref, script, width, height, ASS_HINTING_NONE, ASS_SHAPING_COMPLEX, caches)) {
+        fprintf(stderr, "can't load '%s'\n", script);
+        close_renderer(&ref);
+        return 1;
+    }
+
+    // RUNS stretches of consecutive frames, evenly over the scripted time
+    long long first = -1, last = 0;
+    for (int i = 0; i < ref.track->n_events; i++) {
+        ASS_Event* ev = ref.track->events + i;
+
+        if (first < 0 || ev->Start < first)
+            first = ev->Start;
+        if (ev->Start + ev->Duration > last)
+            last = ev->Start + ev->Duration;
+    }
+    if (first < 0) {
+        fprintf(stderr, "'%s' has no events\n", script);
+        close_renderer(&ref);
+        return 1;
+    }
+
+    long long* times = malloc(samples * sizeof(long long));
+    int per_run = samples / RUNS;
+
+    samples = per_run * RUNS;
+    for (int i = 0; i < samples; i++) {
+        int run = i / per_run;
+        long long base = first + (last - first) * run / RUNS;
+
+        times[i] = base + (long long)(i % per_run) * 1001 / 24;
+    }
+
+    int count = 4 * 2 * (int)(sizeof(caches) / sizeof(caches[0]));
+    tune_result* results = calloc(count, sizeof(tune_result));
+    tune_result* best = NULL;
+    int n = 0;
+
+    printf("%s: %dx%d, %d samples, tolerance %d, %.2f%% of pixels\n", script, width, height, samples, tolerance, percent);
+    printf("%-7s %-8s %-8s %9s %9s %5s %8s %s\n", "hinting", "shaper", "cache", "fps", "peak MiB", "diff", "diff %", "match");
+
+    for (int h = 0; h < 4; h++) {
+        for (int s = 0; s < 2; s++) {
+            for (int c = 0; c < (int)(sizeof(caches) / sizeof(caches[0])); c++) {
+                tune_result* res = results + n++;
+                tune_renderer r;
+                diff_stats d = { 0 };
+                int64_t render_ns = 0;
+
+                reset_peak_rss();
+
+                if (!open_renderer(&r, script, width, height, h, s, caches + c)) {
+                    fprintf(stderr, "can't set up hinting %s, shaper %s\n", hinting_names[h], shaper_names[s]);
+                    close_renderer(&r);
+                    continue;
+                }
+
+                // only the libass render is timed, the comparison isn't
+                for (int i = 0; i < samples; i++) {
+                    int64_t t0 = monotonic_ns();
+                    ASS_Image* img = ass_render_frame(r.ud.ass_renderer, r.track, times[i], NULL);
+
+                    render_ns += monotonic_ns() - t0;
+                    composite(&r, img, width, height);
+                    composite(&ref, ass_render_frame(ref.ud.ass_renderer, ref.track, times[i], NULL), width, height);
+                    compare(&r, &ref, width, height, &d);
+                }
+
+                res->hinting = h;
+                res->shaper = s;
+                res->cache = c;
+                res->fps = samples / (render_ns > 0 ? render_ns / 1e9 : 1e-9);
+                res->peak_mb = peak_rss() / 1048576.0;
+                res->max_diff = d.max_diff;
+                res->diff_percent = d.covered ? 100.0 * d.differing / d.covered : 0;
+                res->match = d.max_diff <= tolerance && res->diff_percent <= percent;
+
+                if (res->match && (!best || res->fps > best->fps))
+                    best = res;
+
+                printf("%-7s %-8s %-8s %9.1f %9.1f %5d %8.3f %s\n",
+                       hinting_names[h], shaper_names[s], caches[c].name, res->fps, res->peak_mb,
+                       res->max_diff, res->diff_percent, res->match ? "yes" : "no");
+
+                close_renderer(&r);
+            }
+        }
+    }
+
+    if (best) {
+        printf("fastest matching: hinting=%d (%s), shaper %s, cache %s",
+               best->hinting, hinting_names[best->hinting], shaper_names[best->shaper], caches[best->cache].name);
+        if (caches[best->cache].glyphs)
+            printf(" (%d glyphs, %d MiB of bitmaps)", caches[best->cache].glyphs, caches[best->cache].bitmaps_mb);
+        printf("\n");
+    }
+    else
+        printf("nothing matches the reference within the tolerance\n");
+
+    free(results);
+    free(times);
+    close_renderer(&ref);
+
+    return best ? 0 : 1;
+}
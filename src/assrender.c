@@ -1,167 +1,109 @@
 #include "assrender.h"
+#include "buckets.h"
+#include "fileio.h"
+#include "frametext.h"
 #include "render.h"
+#include "stats.h"
 #include "sub.h"
 #include "timecodes.h"
+#include "trace.h"
+#include "trackcache.h"
 
-static char* read_file_bytes(FILE* fp, size_t* bufsize)
+static bool is_srt_file(const char* f)
 {
-    int res;
-    long sz;
-    long bytes_read;
-    char* buf;
-    res = fseek(fp, 0, SEEK_END);
-    if (res == -1) {
-        fclose(fp);
-        return 0;
-    }
+    const char* ext = strrchr(f, '.');
+    size_t len;
 
-    sz = ftell(fp);
-    rewind(fp);
+    if (!ext)
+        return false;
 
-    buf = sz < SIZE_MAX ? malloc(sz + 1) : NULL;
-    if (!buf) {
-        fclose(fp);
-        return NULL;
+    // look through a compression suffix, as in foo.srt.gz
+    if (!strcasecmp(ext, ".gz") || !strcasecmp(ext, ".xz")) {
+        const char* p = ext;
+        while (p > f && *(p - 1) != '.')
+            p--;
+        if (p == f)
+            return false;
+        len = ext - (p - 1);
+        ext = p - 1;
     }
-    bytes_read = 0;
-    do {
-        res = fread(buf + bytes_read, 1, sz - bytes_read, fp);
-        if (res <= 0) {
-            fclose(fp);
-            free(buf);
-            return 0;
-        }
-        bytes_read += res;
-    } while (sz - bytes_read > 0);
-    buf[sz] = '\0';
-    fclose(fp);
-
-    if (bufsize)
-        *bufsize = sz;
-    return buf;
-}
-
-static const char* detect_bom(const char* buf, const size_t bufsize) {
-    if (bufsize >= 4) {
-        if (!strncmp(buf, "\xef\xbb\xbf", 3))
-            return "UTF-8";
-        if (!strncmp(buf, "\x00\x00\xfe\xff", 4))
-            return "UTF-32BE";
-        if (!strncmp(buf, "\xff\xfe\x00\x00", 4))
-            return "UTF-32LE";
-        if (!strncmp(buf, "\xfe\xff", 2))
-            return "UTF-16BE";
-        if (!strncmp(buf, "\xff\xfe", 2))
-            return "UTF-16LE";
+    else {
+        len = strlen(ext);
     }
-    return "UTF-8";
-}
 
-#if defined(_MSC_VER) || defined(__MINGW32__)
-#include <windows.h>
-static wchar_t* utf8_to_utf16le(const char* data) {
-    const int out_size = MultiByteToWideChar(CP_UTF8, 0, data, -1, NULL, 0);
-    wchar_t* out = malloc(out_size * sizeof(wchar_t));
-    MultiByteToWideChar(CP_UTF8, 0, data, -1, out, out_size);
-    return out;
+    return len == 4 && !strncasecmp(ext, ".srt", 4);
 }
-#endif
 
-static FILE* open_utf8_filename(const char* f, const char* m)
+// Subtitle() frame numbers to ms, on the same clock get_frame renders at;
+// frames past the end of the clip, or INT_MAX when its length isn't known,
+// leave the event open. Other frames need timecodes or a constant rate.
+static bool frame_to_ms(int frame, const VSVideoInfo* vi, const timecodes* tc, int64_t* ms)
 {
-#if defined(_MSC_VER) || defined(__MINGW32__)
-    wchar_t* file_name = utf8_to_utf16le(f);
-    wchar_t* mode = utf8_to_utf16le(m);
-    FILE* fp = _wfopen(file_name, mode);
-    free(file_name);
-    free(mode);
-    return fp;
-#else
-    return fopen(f, m);
-#endif
-}
-
-static char* strrepl(const char* in, const char* str, const char* repl)
-{
-    size_t siz;
-    char* res, * outptr;
-    const char* inptr;
-    int count = 0;
-
-    inptr = in;
-
-    while ((inptr = strstr(inptr, str))) {
-        count++;
-        inptr++;
+    if (frame <= 0) {
+        *ms = 0;
+        return true;
     }
 
-    if (count == 0) {
-        size_t in_len = strlen(in);
-        res = malloc(in_len + 1);
-        memcpy(res, in, in_len + 1);
-        return res;
+    if (frame == INT_MAX || (vi->numFrames > 0 && frame >= vi->numFrames)) {
+        *ms = INT64_MAX / 4;
+        return true;
     }
 
-    siz = (strlen(in) - strlen(str) * count + strlen(repl) * count) *
-        sizeof(char) + 1;
-
-#define VSMAX(a,b) ((a) > (b) ? (a) : (b))
-    res = malloc(VSMAX(siz, strlen(in) * sizeof(char) + 1));
-#undef VSMAX
-
-    strcpy(res, in);
-
-    outptr = res;
-    inptr = in;
-
-    while ((outptr = strstr(outptr, str)) && (inptr = strstr(inptr, str))) {
-        outptr[0] = '\0';
-        strcat(outptr, repl);
-        strcat(outptr, (inptr + strlen(str)));
-
-        outptr++;
-        inptr++;
+    if (tc) {
+        *ms = timecodes_get(tc, frame);
+        return true;
     }
 
-    return res;
-}
-static bool frameToTime(int frame, int64_t fpsNum, int64_t fpsDen, char* str, size_t str_size)
-{
-    int64_t timeint, time_ms;
-    time_t time_secs;
-    struct tm* ti;
-    if (frame != 0 && (INT64_MAX / fpsDen) < ((int64_t)frame * 100)) {
-        //Overflow would occur
+    if (vi->fpsNum <= 0 || vi->fpsDen <= 0 || INT64_MAX / 1000 / vi->fpsDen < frame) {
         return false;
     }
-    else {
-        timeint = (int64_t)frame * 100 * fpsDen / fpsNum;
-    }
-    time_secs = timeint / 100;
-    time_ms = timeint % 100;
-    ti = gmtime(&time_secs);
-    snprintf(str, str_size, "%d:%02d:%02d.%02" PRIu64, ti->tm_hour, ti->tm_min, ti->tm_sec, time_ms);
 
+    *ms = (int64_t)frame * 1000 * vi->fpsDen / vi->fpsNum;
     return true;
 }
 
-void VS_CC assrender_destroy_vs(void* instanceData, VSCore* core, const VSAPI* vsapi) {
-    const VS_FilterInfo* d = instanceData;
-    udata* ud = d->user_data;
+// whatever of ud has been set up, NULL is fine
+static void free_udata(udata* ud)
+{
+    if (!ud)
+        return;
 
-    ass_renderer_done(((udata*)ud)->ass_renderer);
-    ass_library_done(((udata*)ud)->ass_library);
-    ass_free_track(((udata*)ud)->ass);
+    stop_lookahead(ud);
+    free_glyph_cache(ud->glyphs);
+    stats_unregister(ud->stats);
+    close_trace(ud->trace);
+    mutex_destroy(&ud->lock);
+
+    // the buckets point into the track, which may use the library
+    free_track_buckets(ud->buckets);
+    close_track(ud->ass);
+    if (ud->ass_renderer)
+        ass_renderer_done(ud->ass_renderer);
+    if (ud->ass_library)
+        ass_library_done(ud->ass_library);
+
+    free(ud->sub_img[0]);
+    free(ud->sub_img[1]);
+    free(ud->sub_img[2]);
+    free(ud->sub_img[3]);
+    free(ud->change_points);
+    free(ud->animated);
+    free(ud->frame_text);
+    free(ud->text_buf);
+
+    if (ud->isvfr)
+        close_timecodes(ud->tc);
 
-    free(((udata*)ud)->sub_img[0]);
-    free(((udata*)ud)->sub_img[1]);
-    free(((udata*)ud)->sub_img[2]);
-    free(((udata*)ud)->sub_img[3]);
+    free(ud);
+}
 
-    if (((udata*)ud)->isvfr)
-        free(((udata*)ud)->timestamp);
+void VS_CC assrender_destroy_vs(void* instanceData, VSCore* core, const VSAPI* vsapi) {
+    const VS_FilterInfo* d = instanceData;
+    udata* ud = d->user_data;
 
-    free(ud);
+    if (ud->debuglevel >= 4)
+        stats_print(ud->stats);
+    free_udata(ud);
 
     vsapi->freeNode(d->node);
     free(d);
@@ -179,6 +121,7 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
     int err = 0;
 
     const char* vfr = vsapi->propGetData(in, "vfr", 0, &err);
+    int vfr_props = !!vsapi->propGetInt(in, "vfr_props", 0, &err);
     int h = vsapi->propGetInt(in, "hinting", 0, &err);
     double scale = vsapi->propGetFloat(in, "scale", 0, &err);
     if (err) scale = 1.0;
@@ -200,6 +143,22 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
     if (err) fontdir = "";
     const char* srt_font = vsapi->propGetData(in, "srt_font", 0, &err);
     if (err) srt_font = "sans-serif";
+    const char* srt_style = vsapi->propGetData(in, "srt_style", 0, &err);
+    if (err) srt_style = NULL;
+    double srt_blur = vsapi->propGetFloat(in, "srt_blur", 0, &err);
+    if (err) srt_blur = 0.7;
+    int fast = !!vsapi->propGetInt(in, "fast", 0, &err);
+    int frame_stats = !!vsapi->propGetInt(in, "frame_stats", 0, &err);
+    const char* trace = vsapi->propGetData(in, "trace", 0, &err);
+    if (err) trace = NULL;
+    int glyph_cache = vsapi->propGetInt(in, "glyph_cache", 0, &err);
+    int bitmap_cache = vsapi->propGetInt(in, "bitmap_cache", 0, &err);
+    // bitmaps are rendered at the frame size, scale the cache with it
+    if (err) bitmap_cache = frame_width > 0 && frame_height > 0 ?
+        auto_bitmap_cache(frame_width, frame_height) : auto_bitmap_cache(fi->vi->width, fi->vi->height);
+    const char* shaper_name = vsapi->propGetData(in, "shaper", 0, &err);
+    if (err) shaper_name = "complex";
+    int lookahead = vsapi->propGetInt(in, "lookahead", 0, &err);
     const char* colorspace = vsapi->propGetData(in, "colorspace", 0, &err);
     if (err) colorspace = "";
 
@@ -207,7 +166,7 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
     strncpy(tmpcsp, colorspace, BUFSIZ - 1);
 
     ASS_Hinting hinting;
-    udata* data;
+    udata* data = NULL;
     ASS_Track* ass;
 
     /*
@@ -220,6 +179,16 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
     }
     */
 
+    if (vfr && vfr_props) {
+        vsapi->setError(out, "AssRender: vfr and vfr_props can't be used together");
+        goto fail;
+    }
+
+    if (!vfr && !vfr_props && (fi->vi->fpsNum <= 0 || fi->vi->fpsDen <= 0)) {
+        vsapi->setError(out, "AssRender: clip has variable frame rate, use vfr or vfr_props");
+        goto fail;
+    }
+
     switch (h) {
     case 0:
         hinting = ASS_HINTING_NONE;
@@ -235,194 +204,209 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
         break;
     default:
         vsapi->setError(out, "AssRender: invalid hinting mode");
-        return;
+        goto fail;
     }
 
-    data = malloc(sizeof(udata));
+    // -1 picks one once the text is known
+    int shaper;
+
+    if (!strcasecmp(shaper_name, "simple"))
+        shaper = ASS_SHAPING_SIMPLE;
+    else if (!strcasecmp(shaper_name, "complex"))
+        shaper = ASS_SHAPING_COMPLEX;
+    else if (!strcasecmp(shaper_name, "auto"))
+        shaper = -1;
+    else {
+        vsapi->setError(out, "AssRender: shaper must be simple, complex or auto");
+        goto fail;
+    }
+
+    if (lookahead < 0 || lookahead > 64) {
+        vsapi->setError(out, "AssRender: lookahead must be between 0 and 64");
+        goto fail;
+    }
+
+    // the worker has to know the times and texts of frames not there yet
+    if (lookahead && (vfr_props || !strcmp(userData, "FrameText"))) {
+        vsapi->setError(out, "AssRender: lookahead can't be used with vfr_props or FrameText");
+        goto fail;
+    }
+
+    if (glyph_cache < 0 || bitmap_cache < 0) {
+        vsapi->setError(out, "AssRender: cache sizes can't be negative");
+        goto fail;
+    }
+
+    data = calloc(1, sizeof(udata));
+    if (!data) {
+        vsapi->setError(out, "AssRender: out of memory");
+        goto fail;
+    }
+
+    mutex_init(&data->lock);
 
     if (!init_ass(
-        fi->vi->width, fi->vi->height, scale, line_spacing, hinting,
+        fi->vi->width, fi->vi->height, scale, line_spacing, hinting, glyph_cache, bitmap_cache,
         frame_width, frame_height, dar, sar, set_default_storage_size,
         top, bottom, left, right, debuglevel,
         fontdir, data)
     ) {
         vsapi->setError(out, "AssRender: failed to initialize");
-        return;
+        goto fail;
     }
 
+    // FrameText's text changes every frame, auto can't tell in advance
+    if (shaper < 0 && !strcmp(userData, "FrameText"))
+        shaper = ASS_SHAPING_COMPLEX;
+    if (shaper >= 0)
+        ass_set_shaper(data->ass_renderer, shaper);
+
+    if (vfr) {
+        const char* tc_error = NULL;
+
+        data->tc = open_timecodes(vfr, fi->vi->numFrames, &tc_error);
+
+        if (!data->tc) {
+            snprintf(e, 256, "AssRender: %s '%s'", tc_error, vfr);
+            vsapi->setError(out, e);
+            goto fail;
+        }
+
+        data->isvfr = 1;
+    }
+    else {
+        data->isvfr = 0;
+    }
+
+    data->vfr_props = vfr_props;
+    data->frame_stats = frame_stats;
+    data->debuglevel = debuglevel;
+
     if (!strcmp(userData, "TextSub")) {
         const char* f = vsapi->propGetData(in, "file", 0, &err);
         if (!f) {
             vsapi->setError(out, "AssRender: no input file specified");
-            return;
+            goto fail;
         }
-        if (!strcasecmp(strrchr(f, '.'), ".srt")) {
-            FILE* fp = open_utf8_filename(f, "r");
-            ass = parse_srt(fp, data, srt_font);
+        if (is_srt_file(f)) {
+            sub_stream* fs = stream_open(f);
+            if (!fs || stream_error(fs)) {
+                snprintf(e, 256, "AssRender: could not read subtitle file '%s': %s", f, fs ? stream_error(fs) : "out of memory");
+                vsapi->setError(out, e);
+                stream_close(fs);
+                goto fail;
+            }
+            ass = parse_srt(fs, data, srt_font, srt_style, srt_blur);
+            if (stream_error(fs)) {
+                snprintf(e, 256, "AssRender: could not read subtitle file '%s': %s", f, stream_error(fs));
+                vsapi->setError(out, e);
+                stream_close(fs);
+                if (ass)
+                    ass_free_track(ass);
+                goto fail;
+            }
+            stream_close(fs);
         }
         else {
-            FILE* fp = open_utf8_filename(f, "rb");
-            size_t bufsize;
-            char* buf = read_file_bytes(fp, &bufsize);
-            if (cs == NULL) cs = detect_bom(buf, bufsize);
-            ass = ass_read_memory(data->ass_library, buf, bufsize, (char*)cs);
-            fp = open_utf8_filename(f, "r");
-            ass_read_matrix(fp, tmpcsp);
+            const char* error;
+
+            // parsed once for every filter of the same file
+            ass = open_shared_track(data->ass_library, f, cs, debuglevel, tmpcsp, &error);
+            if (error) {
+                snprintf(e, 256, "AssRender: could not read subtitle file '%s': %s", f, error);
+                vsapi->setError(out, e);
+                goto fail;
+            }
+        }
+    }
+    else if (!strcmp(userData, "FrameText")) {
+        const char* text = vsapi->propGetData(in, "text", 0, &err);
+
+        const char *style = vsapi->propGetData(in, "style", 0, &err);
+        if (err) style = "sans-serif,20,&H00FFFFFF,&H000000FF,&H00000000,&H00000000,0,0,0,0,100,100,0,0,1,2,0,7,10,10,10,1";
+
+        // one event for the whole clip, its text is replaced every frame;
+        // it starts out as the template so its tags count as animated or not
+        ass = new_subtitle_track(data->ass_library, fi->vi->width, fi->vi->height, style);
+        data->frame_text = strdup(text);
+
+        if (ass && (!data->frame_text || !add_subtitle_event(ass, INT64_MIN / 4, INT64_MAX / 4, text))) {
+            ass_free_track(ass);
+            ass = NULL;
+        }
+
+        // plain text can be drawn from a glyph cache instead of libass
+        if (ass && fast) {
+            ASS_Track* scratch = new_subtitle_track(data->ass_library, fi->vi->width, fi->vi->height, style);
+
+            if (scratch && add_subtitle_event(scratch, 0, 1, ""))
+                data->glyphs = new_glyph_cache(scratch, data->ass_renderer, fi->vi->width, fi->vi->height);
+            else
+                ass_free_track(scratch);
         }
     }
     else {// if (!strcmp(userData, "Subtitle")){
-#define BUFFER_SIZE 16
         int ntext = vsapi->propNumElements(in, "text");
         if (ntext < 1) {
             vsapi->setError(out, "AssRender: No text to be rendered");
-            return;
-        }
-        
-        char **texts = malloc(ntext * sizeof(char *));
-        int *text_lengths = malloc(ntext * sizeof(int));
-        for (int i = 0; i < ntext; i++) {
-            texts[i] = vsapi->propGetData(in, "text", i, &err);
-            if (err) texts[i] = "";
-            texts[i] = strrepl(texts[i], "\n", "\\N");
-            text_lengths[i] = strlen(texts[i]);
+            goto fail;
         }
 
         const char *style = vsapi->propGetData(in, "style", 0, &err);
         if (err) style = "sans-serif,20,&H00FFFFFF,&H000000FF,&H00000000,&H00000000,0,0,0,0,100,100,0,0,1,2,0,7,10,10,10,1";
 
-        int *startframes = malloc(ntext * sizeof(int));
-        int *endframes = malloc(ntext * sizeof(int));
         int nstart = vsapi->propNumElements(in, "start");
         int nend = vsapi->propNumElements(in, "end");
         int nspan = nstart < nend ? nstart : nend;
-        if (nspan < 1) {
-            for (int i = 0; i < ntext; i++)
-                startframes[i] = 0, endframes[i] = fi->vi->numFrames;
-        }
-        else {
-            for (int i = 0; i < nspan; i++) {
-                startframes[i] = vsapi->propGetInt(in, "start", i, &err);
-                if (err) startframes[i] = 0;
-                endframes[i] = vsapi->propGetInt(in, "end", i, &err);
-                if (err) endframes[i] = fi->vi->numFrames;
-            }
-            for (int i = nspan; i < ntext; ++i) {
-                startframes[i] = startframes[nspan - 1];
-                endframes[i] = endframes[nspan - 1];
-            }
-        }
-
-        int full_dialogues_length = 0;
-        for (int i = 0; i < ntext; i++) {
-            char start[BUFFER_SIZE] = { 0 }, end[BUFFER_SIZE] = { 0 };
-            if (!frameToTime(startframes[i], fi->vi->fpsNum, fi->vi->fpsDen, start, BUFFER_SIZE) ||
-                !frameToTime(endframes[i], fi->vi->fpsNum, fi->vi->fpsDen, end, BUFFER_SIZE)) {
-                snprintf(e, 256, "AssRender: Unable to calculate %s time", start[0] ? "end" : "start");
-                goto clean;
-            }
-            int dialogue_space = 32 + strlen(start) + strlen(end) + text_lengths[i];
-            char *tmp = malloc(dialogue_space);
-            snprintf(tmp, dialogue_space, "Dialogue: 0,%s,%s,Default,,0,0,0,,%s\n", start, end, texts[i]);
-            free(texts[i]);
-            texts[i] = tmp;
-            text_lengths[i] = dialogue_space - 1;
-            full_dialogues_length += text_lengths[i];
-        }
 
-        char x[BUFFER_SIZE], y[BUFFER_SIZE];
-        const char *fmt = "[Script Info]\n"
-            "ScriptType: v4.00+\n"
-            "PlayResX: %s\n"
-            "PlayResY: %s\n"
-            "[V4+ Styles]\n"
-            "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n"
-            "Style: Default,%s\n"
-            "[Events]\n"
-            "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
-
-        snprintf(x, BUFFER_SIZE, "%d", fi->vi->width);
-        snprintf(y, BUFFER_SIZE, "%d", fi->vi->height);
-
-        size_t siz = (412 + strlen(x) + strlen(y) + strlen(style) + full_dialogues_length) * sizeof(char);
-
-        char *final_text = malloc(siz);
-        snprintf(final_text, siz, fmt, x, y, style);
-
-        int pos = strlen(final_text);
-        for (int i = 0; i < ntext; i++) {
-            memcpy(final_text + pos, texts[i], text_lengths[i]);
-            pos += text_lengths[i];
-        }
-        final_text[pos] = 0;
+        ass = new_subtitle_track(data->ass_library, fi->vi->width, fi->vi->height, style);
 
-        ass = ass_read_memory(data->ass_library, final_text, pos, "UTF-8");
+        for (int i = 0; ass && i < ntext; i++) {
+            // texts past the given spans reuse the last one
+            int span = i < nspan ? i : nspan - 1;
+            int open_end = fi->vi->numFrames > 0 ? fi->vi->numFrames : INT_MAX;
+            int startframe = 0, endframe = open_end;
+            int64_t start, end;
 
-        free(final_text);
+            if (span >= 0) {
+                startframe = vsapi->propGetInt(in, "start", span, &err);
+                if (err) startframe = 0;
+                endframe = vsapi->propGetInt(in, "end", span, &err);
+                if (err) endframe = open_end;
+            }
 
-    clean:
-        free(startframes);
-        free(endframes);
-        free(text_lengths);
-        for (int i = 0; i < ntext; i++)
-            free(texts[i]);
-        free(texts);
+            const char* text = vsapi->propGetData(in, "text", i, &err);
+            if (err) text = "";
 
-        if (*e)
-            vsapi->setError(out, e);
+            if (!frame_to_ms(startframe, fi->vi, data->tc, &start) ||
+                !frame_to_ms(endframe, fi->vi, data->tc, &end)) {
+                vsapi->setError(out, "AssRender: Unable to calculate start/end time, start and end frames other than 0 need vfr or a constant frame rate clip");
+                ass_free_track(ass);
+                goto fail;
+            }
 
-#undef BUFFER_SIZE
+            if (!add_subtitle_event(ass, start, end, text)) {
+                ass_free_track(ass);
+                ass = NULL;
+            }
+        }
     }
 
     if (!ass) {
         vsapi->setError(out, "AssRender: unable to parse ass text");
-        return;
+        goto fail;
     }
 
     data->ass = ass;
 
-    if (vfr) {
-        int ver;
-        FILE* fh = open_utf8_filename(vfr, "r");
-
-        if (!fh) {
-            snprintf(e, 256, "AssRender: could not read timecodes file '%s'", vfr);
-            vsapi->setError(out, e);
-            return;
-        }
-
-        data->isvfr = 1;
-
-        if (fscanf(fh, "# timecode format v%d", &ver) != 1) {
-            snprintf(e, 256, "AssRender: invalid timecodes file '%s'", vfr);
-            vsapi->setError(out, e);
-            return;
-        }
-
-        switch (ver) {
-        case 1:
-
-            if (!parse_timecodesv1(fh, fi->vi->numFrames, data)) {
-                vsapi->setError(out, "AssRender: error parsing timecodes file");
-                return;
-            }
-
-            break;
-        case 2:
-
-            if (!parse_timecodesv2(fh, fi->vi->numFrames, data)) {
-                vsapi->setError(out, "AssRender: timecodes file had less frames than expected");
-                return;
-            }
-
-            break;
-        }
-
-        fclose(fh);
-    }
-    else {
-        data->isvfr = 0;
+    if (shaper < 0) {
+        shaper = needs_complex_shaper(ass) ? ASS_SHAPING_COMPLEX : ASS_SHAPING_SIMPLE;
+        ass_set_shaper(data->ass_renderer, shaper);
     }
 
+    build_static_intervals(data);
+    data->buckets = split_track(ass);
+
     matrix_type color_mt;
 
     if (fi->vi->format->colorFamily == cmRGB) {
@@ -487,7 +471,7 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
         data->f_make_sub_img = make_sub_img16;
     else {
         vsapi->setError(out, "AssRender: unsupported bit depth: 32");
-        return;
+        goto fail;
     }
 
 
@@ -530,10 +514,11 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
         break;
     default:
         vsapi->setError(out, "AssRender: unsupported pixel type");
-        return;
+        goto fail;
     }
 
     free(tmpcsp);
+    tmpcsp = NULL;
 
     const int buffersize = fi->vi->width * fi->vi->height * pixelsize;
 
@@ -547,14 +532,48 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
     data->rgb_fullscale = fi->vi->format->colorFamily == cmRGB;
     data->greyscale = greyscale;
 
+    const char* file = vsapi->propGetData(in, "file", 0, &err);
+    if (!err)
+        snprintf(e, 256, "%s '%s'", (const char*)userData, file);
+    else
+        snprintf(e, 256, "%s", (const char*)userData);
+    data->stats = stats_register(e);
+    if (data->stats) {
+        data->stats->glyph_cache = glyph_cache;
+        data->stats->bitmap_cache = bitmap_cache;
+        data->stats->shaper = shaper;
+    }
+
+    if (trace) {
+        data->trace = open_trace(trace);
+        if (!data->trace) {
+            snprintf(e, 256, "AssRender: could not create trace file '%s'", trace);
+            vsapi->setError(out, e);
+            goto fail;
+        }
+    }
+
+    if (!start_lookahead(data, fi->vi, lookahead)) {
+        vsapi->setError(out, "AssRender: could not start the lookahead thread");
+        goto fail;
+    }
+
     fi->user_data = data;
 
+    // libass and the overlay are shared, VapourSynth runs one request at a time
     vsapi->createFilter(in, out, userData, assrender_init_vs, assrender_get_frame_vs, assrender_destroy_vs, fmParallelRequests, 0, fi, core);
 
     return;
+
+fail:
+    free_udata(data);
+    free(tmpcsp);
+    vsapi->freeNode(fi->node);
+    free(fi);
 }
 #define COMMON_PARAMS \
         "vfr:data:opt;" \
+        "vfr_props:int:opt;" \
         "hinting:int:opt;" \
         "scale:float:opt;" \
         "line_spacing:float:opt;" \
@@ -571,7 +590,15 @@ void VS_CC assrender_create_vs(const VSMap* in, VSMap* out, void* userData, VSCo
         "debuglevel:int:opt;" \
         "fontdir:data:opt;" \
         "srt_font:data:opt;" \
-        "colorspace:data:opt;",
+        "srt_style:data:opt;" \
+        "srt_blur:float:opt;" \
+        "colorspace:data:opt;" \
+        "frame_stats:int:opt;" \
+        "trace:data:opt;" \
+        "glyph_cache:int:opt;" \
+        "bitmap_cache:int:opt;" \
+        "shaper:data:opt;" \
+        "lookahead:int:opt;",
 void VS_CC VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin* plugin) {
     configFunc("com.pinterf.assrender", "assrender", "AssRender", VAPOURSYNTH_API_VERSION, 1, plugin);
     registerFunc("TextSub",
@@ -579,6 +606,13 @@ void VS_CC VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction r
         "file:data;"
         COMMON_PARAMS
         assrender_create_vs, "TextSub", plugin);
+    registerFunc("FrameText",
+        "clip:clip;"
+        "text:data;"
+        "style:data:opt;"
+        "fast:int:opt;"
+        COMMON_PARAMS
+        assrender_create_vs, "FrameText", plugin);
     registerFunc("Subtitle",
         "clip:clip;"
         "text:data[];"
@@ -587,4 +621,5 @@ void VS_CC VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction r
         "end:int[]:opt;"
         COMMON_PARAMS
         assrender_create_vs, "Subtitle", plugin);
+    registerFunc("Stats", "", stats_vs, NULL, plugin);
 }
\ No newline at end of file
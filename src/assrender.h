@@ -7,15 +7,18 @@
 #include <inttypes.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
 #include <ass/ass.h>
 #include "VapourSynth.h"
+#include "thread.h"
 
 #if defined(_MSC_VER)
 #define __NO_ISOCEXT
 #define __NO_INLINE__
 
 #define strcasecmp _stricmp
+#define strncasecmp _strnicmp
 #define atoll _atoi64
 #endif
 
@@ -43,18 +46,48 @@ typedef enum {
 } matrix_type;
 
 typedef void (* fPixel)(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t width, uint32_t height);
-typedef void (* fMakeSubImg)(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_per_pixel, int rgb, ConversionMatrix* m);
+// sub_img has a stride of width pixels and starts at x0, y0 of the frame
+typedef void (* fMakeSubImg)(ASS_Image* img, uint8_t** sub_img, uint32_t width, int x0, int y0, int bits_per_pixel, int rgb, ConversionMatrix* m);
 
 void col2yuv(uint32_t* c, uint8_t* y, uint8_t* u, uint8_t* v, ConversionMatrix* m);
 void col2rgb(uint32_t* c, uint8_t* r, uint8_t* g, uint8_t* b);
 
+typedef struct {
+    int first;      // first frame of the range
+    double step;    // frame duration in ms
+} tc_segment;
+
+typedef struct {
+    // v1: constant rate ranges, frame times are computed on lookup
+    tc_segment* segments;
+    int nsegments;
+    double* checkpoints;
+    int ncheckpoints;
+    // v2: one timestamp per frame
+    int64_t* timestamp;
+    int count;
+} timecodes;
+
+// an overlay rendered ahead of time, with the same fields as the current
+// one in udata so the two can be swapped
+typedef struct {
+    int rendered;
+    uint8_t* sub_img[4];
+    int bbox_x, bbox_y, bbox_w, bbox_h;
+    int overlay_images;
+    int64_t overlay_area;
+    int64_t static_start, static_end;
+    int changed;
+} lookahead_slot;
+
 typedef struct {
     uint8_t* sub_img[4];
     uint32_t isvfr;
+    uint32_t vfr_props;
     ASS_Track* ass;
     ASS_Library* ass_library;
     ASS_Renderer* ass_renderer;
-    int64_t* timestamp;
+    timecodes* tc;
     ConversionMatrix mx;
     fPixel apply;
     fMakeSubImg f_make_sub_img;
@@ -62,6 +95,48 @@ typedef struct {
     int pixelsize;
     int rgb_fullscale;
     int greyscale;
+    // the last overlay, sub_img holds only its bounding box
+    int rendered;
+    int bbox_x, bbox_y, bbox_w, bbox_h;
+    // render times where the visible events change, and for each interval
+    // between two of them whether anything in it is animated
+    int64_t* change_points;
+    uint8_t* animated;
+    int nchange_points;
+    // per-minute views of big tracks, NULL if the track is rendered as is
+    struct track_buckets* buckets;
+    // the overlay can be reused for any time in here
+    int64_t static_start, static_end;
+    // FrameText template and the buffer it is expanded into
+    char* frame_text;
+    char* text_buf;
+    size_t text_cap;
+    struct glyph_cache* glyphs;
+    // frame_stats: stage timings and overlay size as frame properties
+    int frame_stats;
+    int overlay_images;
+    int64_t overlay_area;
+    // cumulative counters, printed at destroy from this debuglevel on
+    struct render_stats* stats;
+    int debuglevel;
+    // sub_img[0] of the overlay libass last rendered into, its changed
+    // flag says nothing about any other
+    uint8_t* last_composite;
+    // lookahead: a worker renders the frames from ahead_next on into the
+    // slots while no frame needs the renderer, one slot per hold of the
+    // lock; ahead_next is -1 until the first request
+    int lookahead;
+    lookahead_slot* slots;
+    int ahead_next;
+    int ahead_stop;
+    // requests blocked on the lock, the worker stays out while there are any
+    counter ahead_waiting;
+    const VSVideoInfo* vi;
+    cond ahead_cond;
+    thread ahead_thread;
+    // guards everything above while frames are rendered in parallel
+    mutex lock;
+    struct tracer* trace;
 } udata;
 typedef struct {
     VSNodeRef* node;
@@ -0,0 +1,160 @@
+#include "buckets.h"
+
+struct track_buckets {
+    ASS_Track* track;
+    int64_t start;
+    int count;
+    ASS_Track* views;
+    int** index;        // event of the track each copy was made from
+    int current;        // view whose copies hold the render_priv pointers
+};
+
+// libass keeps per-event state (the placement for collision handling) in
+// render_priv and frees it with the event, so only one copy of an event may
+// hold it at a time and it goes back to the track when the view changes
+static void return_render_priv(track_buckets* tb)
+{
+    if (tb->current < 0)
+        return;
+
+    ASS_Track* view = tb->views + tb->current;
+
+    for (int i = 0; i < view->n_events; i++) {
+        tb->track->events[tb->index[tb->current][i]].render_priv = view->events[i].render_priv;
+        view->events[i].render_priv = NULL;
+    }
+
+    tb->current = -1;
+}
+
+track_buckets* split_track(ASS_Track* track)
+{
+    track_buckets* tb;
+    int64_t start = INT64_MAX, end = INT64_MIN;
+    int* counts;
+
+    if (track->n_events < BUCKET_MIN_EVENTS)
+        return NULL;
+
+    for (int i = 0; i < track->n_events; i++) {
+        ASS_Event* event = track->events + i;
+
+        if (event->Duration <= 0)
+            continue;
+        if (event->Start < start)
+            start = event->Start;
+        if (event->Start + event->Duration > end)
+            end = event->Start + event->Duration;
+    }
+
+    if (end <= start || (end - start) / BUCKET_MS < 1 || (end - start) / BUCKET_MS >= INT_MAX)
+        return NULL;
+
+    tb = calloc(1, sizeof(track_buckets));
+    if (!tb)
+        return NULL;
+
+    tb->track = track;
+    tb->start = start;
+    tb->count = (int)((end - 1 - start) / BUCKET_MS) + 1;
+    tb->current = -1;
+    tb->views = calloc(tb->count, sizeof(ASS_Track));
+    tb->index = calloc(tb->count, sizeof(int*));
+    counts = calloc(tb->count, sizeof(int));
+
+    if (!tb->views || !tb->index || !counts) {
+        free(counts);
+        free_track_buckets(tb);
+        return NULL;
+    }
+
+    // events that are never shown stay out, the rest go into every
+    // bucket they overlap
+    for (int i = 0; i < track->n_events; i++) {
+        ASS_Event* event = track->events + i;
+
+        if (event->Duration <= 0)
+            continue;
+        for (int64_t b = (event->Start - start) / BUCKET_MS; b <= (event->Start + event->Duration - 1 - start) / BUCKET_MS; b++)
+            counts[b]++;
+    }
+
+    for (int b = 0; b < tb->count; b++) {
+        ASS_Track* view = tb->views + b;
+
+        *view = *track;
+        view->n_events = 0;
+        view->max_events = counts[b];
+        view->events = malloc((counts[b] ? counts[b] : 1) * sizeof(ASS_Event));
+        tb->index[b] = malloc((counts[b] ? counts[b] : 1) * sizeof(int));
+
+        if (!view->events || !tb->index[b]) {
+            free(counts);
+            free_track_buckets(tb);
+            return NULL;
+        }
+    }
+
+    free(counts);
+
+    // in track order, which libass also goes by for events on the same layer
+    for (int i = 0; i < track->n_events; i++) {
+        ASS_Event* event = track->events + i;
+
+        if (event->Duration <= 0)
+            continue;
+        for (int64_t b = (event->Start - start) / BUCKET_MS; b <= (event->Start + event->Duration - 1 - start) / BUCKET_MS; b++) {
+            ASS_Track* view = tb->views + b;
+
+            view->events[view->n_events] = *event;
+            view->events[view->n_events].render_priv = NULL;
+            tb->index[b][view->n_events++] = i;
+        }
+    }
+
+    return tb;
+}
+
+ASS_Track* bucket_track(track_buckets* tb, int64_t ts)
+{
+    int64_t b = ts < tb->start ? 0 : (ts - tb->start) / BUCKET_MS;
+
+    if (b >= tb->count)
+        b = tb->count - 1;
+
+    if (b != tb->current) {
+        ASS_Track* view = tb->views + b;
+
+        return_render_priv(tb);
+
+        for (int i = 0; i < view->n_events; i++) {
+            ASS_Event* event = tb->track->events + tb->index[b][i];
+
+            view->events[i].render_priv = event->render_priv;
+            event->render_priv = NULL;
+        }
+
+        tb->current = (int)b;
+    }
+
+    return tb->views + tb->current;
+}
+
+void free_track_buckets(track_buckets* tb)
+{
+    if (!tb)
+        return;
+
+    return_render_priv(tb);
+
+    for (int b = 0; b < tb->count; b++) {
+        if (tb->views)
+            free(tb->views[b].events);
+        if (tb->index)
+            free(tb->index[b]);
+    }
+
+    free(tb->views);
+    free(tb->index);
+    free(tb);
+}
@@ -0,0 +1,25 @@
+#ifndef _BUCKETS_H_
+#define _BUCKETS_H_
+
+#include "assrender.h"
+
+// tracks with fewer events are rendered as they are
+#define BUCKET_MIN_EVENTS 4096
+#define BUCKET_MS 60000
+
+// Shallow copies of a big track, one per BUCKET_MS of time, that hold only
+// the events overlapping their bucket. libass walks every event of the track
+// it renders, so this keeps the per-frame cost to the events nearby. The
+// copies share everything but the event array with the track.
+typedef struct track_buckets track_buckets;
+
+// NULL if the track is too small or short to be worth splitting
+track_buckets* split_track(ASS_Track* track);
+
+// the copy to render ts from; the track must not change meanwhile
+ASS_Track* bucket_track(track_buckets* tb, int64_t ts);
+
+// before the track itself is freed
+void free_track_buckets(track_buckets* tb);
+
+#endif
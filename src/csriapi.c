@@ -1,6 +1,7 @@
 #include "assrender.h"
 #include "render.h"
 #include "sub.h"
+#include "timecodes.h"
 
 #if defined(_WIN32)
 #    define CSRIAPI __declspec(dllexport)
@@ -35,7 +36,7 @@ CSRIAPI csri_inst *csri_open_file(csri_rend *renderer, const char *filename, str
 
     inst->set_default_storage_size = *renderer != csri_assrender_ob;
 
-    if (init_ass(0, 0, 1.0, 0, ASS_HINTING_NONE, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, "", inst->ud)) {
+    if (init_ass(0, 0, 1.0, 0, ASS_HINTING_NONE, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, "", inst->ud)) {
         ASS_Track *ass = ass_read_file(inst->ud->ass_library, filename, (char *)"utf-8");
         if (ass) {
             inst->ud->ass = ass;
@@ -59,7 +60,7 @@ CSRIAPI csri_inst *csri_open_mem(csri_rend *renderer, const void *data, size_t l
 
     inst->set_default_storage_size = *renderer != csri_assrender_ob;
 
-    if (init_ass(0, 0, 1.0, 0, ASS_HINTING_NONE, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, "", inst->ud)) {
+    if (init_ass(0, 0, 1.0, 0, ASS_HINTING_NONE, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, "", inst->ud)) {
         ASS_Track *ass = ass_read_memory(inst->ud->ass_library, data, length, (char *)"utf-8");
         if (ass) {
             inst->ud->ass = ass;
@@ -91,7 +92,7 @@ CSRIAPI void csri_close(csri_inst *inst)
     }
 
     if (ud->isvfr)
-        free(ud->timestamp);
+        close_timecodes(ud->tc);
 
     free(ud);
     free(inst);
@@ -176,7 +177,7 @@ CSRIAPI void csri_render(csri_inst *inst, struct csri_frame *frame, double time)
         
         if (changed) {
             memset(inst->ud->sub_img[0], 0x00, height * width * inst->ud->pixelsize);
-            inst->ud->f_make_sub_img(img, inst->ud->sub_img, width, inst->ud->bits_per_pixel, inst->ud->rgb_fullscale, &inst->ud->mx);
+            inst->ud->f_make_sub_img(img, inst->ud->sub_img, width, 0, 0, inst->ud->bits_per_pixel, inst->ud->rgb_fullscale, &inst->ud->mx);
         }
 
         inst->ud->apply(inst->ud->sub_img, data, pitch, width, height);
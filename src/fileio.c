@@ -0,0 +1,366 @@
+#include "fileio.h"
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#include <windows.h>
+#include <sys/stat.h>
+static wchar_t* utf8_to_utf16le(const char* data) {
+    const int out_size = MultiByteToWideChar(CP_UTF8, 0, data, -1, NULL, 0);
+    wchar_t* out = malloc(out_size * sizeof(wchar_t));
+    MultiByteToWideChar(CP_UTF8, 0, data, -1, out, out_size);
+    return out;
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FILE* open_utf8_filename(const char* f, const char* m)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    wchar_t* file_name = utf8_to_utf16le(f);
+    wchar_t* mode = utf8_to_utf16le(m);
+    FILE* fp = _wfopen(file_name, mode);
+    free(file_name);
+    free(mode);
+    return fp;
+#else
+    return fopen(f, m);
+#endif
+}
+
+int file_stat(const char* filename, long long* size, long long* mtime)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    // _wstat64 has whole seconds only, the file times are in 100 ns
+    WIN32_FILE_ATTRIBUTE_DATA fa;
+    wchar_t* file_name = utf8_to_utf16le(filename);
+    BOOL res = GetFileAttributesExW(file_name, GetFileExInfoStandard, &fa);
+    free(file_name);
+
+    if (!res)
+        return 0;
+
+    *size = (long long)fa.nFileSizeHigh << 32 | fa.nFileSizeLow;
+    *mtime = ((long long)fa.ftLastWriteTime.dwHighDateTime << 32 | fa.ftLastWriteTime.dwLowDateTime) * 100;
+#else
+    struct stat st;
+
+    if (stat(filename, &st))
+        return 0;
+
+    *size = (long long)st.st_size;
+#if defined(__APPLE__)
+    *mtime = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    *mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+    return 1;
+}
+
+int map_file(const char* filename, mapped_file* mf)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    LARGE_INTEGER sz;
+    wchar_t* file_name = utf8_to_utf16le(filename);
+    HANDLE fh = CreateFileW(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    free(file_name);
+
+    if (fh == INVALID_HANDLE_VALUE)
+        return 0;
+
+    if (!GetFileSizeEx(fh, &sz) || (unsigned long long)sz.QuadPart > SIZE_MAX) {
+        CloseHandle(fh);
+        return 0;
+    }
+
+    mf->size = (size_t)sz.QuadPart;
+    mf->mapping = NULL;
+
+    if (mf->size == 0) {
+        CloseHandle(fh);
+        mf->data = "";
+        return 1;
+    }
+
+    mf->mapping = CreateFileMappingW(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+
+    if (!mf->mapping)
+        return 0;
+
+    mf->data = MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mf->data) {
+        CloseHandle(mf->mapping);
+        return 0;
+    }
+
+    return 1;
+#else
+    struct stat st;
+    void* p;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+        return 0;
+
+    if (fstat(fd, &st) == -1 || (unsigned long long)st.st_size > SIZE_MAX) {
+        close(fd);
+        return 0;
+    }
+
+    mf->size = (size_t)st.st_size;
+
+    if (mf->size == 0) {
+        close(fd);
+        mf->data = "";
+        return 1;
+    }
+
+    p = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return 0;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(p, mf->size, MADV_SEQUENTIAL);
+#endif
+
+    mf->data = p;
+
+    return 1;
+#endif
+}
+
+void unmap_file(mapped_file* mf)
+{
+    if (!mf->size)
+        return;
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    UnmapViewOfFile(mf->data);
+    CloseHandle(mf->mapping);
+#else
+    munmap((void*)mf->data, mf->size);
+#endif
+}
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#define STREAM_CHUNK 65536
+
+enum {
+    STREAM_PLAIN,
+    STREAM_GZIP,
+    STREAM_XZ
+};
+
+struct sub_stream {
+    FILE* fp;
+    int type;
+    int eof;
+    int done;
+    const char* error;
+    unsigned char in[STREAM_CHUNK];
+    size_t in_pos, in_len;
+#ifdef HAVE_ZLIB
+    z_stream zs;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream xz;
+#endif
+};
+
+static int stream_fill(sub_stream* s)
+{
+    if (s->in_pos < s->in_len)
+        return 1;
+
+    s->in_pos = 0;
+    s->in_len = s->eof ? 0 : fread(s->in, 1, STREAM_CHUNK, s->fp);
+
+    if (s->in_len < STREAM_CHUNK) {
+        if (ferror(s->fp))
+            s->error = "read error";
+        s->eof = 1;
+    }
+
+    return s->in_len != 0;
+}
+
+sub_stream* stream_open(const char* filename)
+{
+    sub_stream* s = calloc(1, sizeof(sub_stream));
+
+    if (!s)
+        return NULL;
+
+    s->fp = open_utf8_filename(filename, "rb");
+    if (!s->fp) {
+        s->error = "could not open file";
+        return s;
+    }
+
+    stream_fill(s);
+
+    if (s->in_len >= 2 && s->in[0] == 0x1f && s->in[1] == 0x8b) {
+#ifdef HAVE_ZLIB
+        // 15 + 32: accept gzip and zlib headers
+        if (inflateInit2(&s->zs, 15 + 32) == Z_OK)
+            s->type = STREAM_GZIP;
+        else
+            s->error = "could not initialize zlib";
+#else
+        s->error = "gzip input is not supported by this build";
+#endif
+    }
+    else if (s->in_len >= 6 && !memcmp(s->in, "\xfd" "7zXZ\0", 6)) {
+#ifdef HAVE_LZMA
+        lzma_stream init = LZMA_STREAM_INIT;
+        s->xz = init;
+        if (lzma_stream_decoder(&s->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK)
+            s->type = STREAM_XZ;
+        else
+            s->error = "could not initialize liblzma";
+#else
+        s->error = "xz input is not supported by this build";
+#endif
+    }
+
+    return s;
+}
+
+void stream_close(sub_stream* s)
+{
+    if (!s)
+        return;
+
+#ifdef HAVE_ZLIB
+    if (s->type == STREAM_GZIP)
+        inflateEnd(&s->zs);
+#endif
+#ifdef HAVE_LZMA
+    if (s->type == STREAM_XZ)
+        lzma_end(&s->xz);
+#endif
+
+    if (s->fp)
+        fclose(s->fp);
+
+    free(s);
+}
+
+int stream_compressed(const sub_stream* s)
+{
+    return s->type != STREAM_PLAIN;
+}
+
+const char* stream_error(const sub_stream* s)
+{
+    return s->error;
+}
+
+#ifdef HAVE_ZLIB
+static size_t read_gzip(sub_stream* s, char* buf, size_t size)
+{
+    s->zs.next_out = (Bytef*)buf;
+    s->zs.avail_out = (uInt)(size > UINT32_MAX ? UINT32_MAX : size);
+
+    while (s->zs.avail_out) {
+        int ret;
+
+        if (!stream_fill(s))
+            break;
+
+        s->zs.next_in = s->in + s->in_pos;
+        s->zs.avail_in = (uInt)(s->in_len - s->in_pos);
+
+        ret = inflate(&s->zs, Z_NO_FLUSH);
+        s->in_pos = s->in_len - s->zs.avail_in;
+
+        if (ret == Z_STREAM_END) {
+            // concatenated members, as produced by appending gzip files
+            if (!stream_fill(s))
+                break;
+            inflateReset(&s->zs);
+        }
+        else if (ret != Z_OK) {
+            s->error = "corrupt gzip data";
+            break;
+        }
+    }
+
+    return (char*)s->zs.next_out - buf;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static size_t read_xz(sub_stream* s, char* buf, size_t size)
+{
+    s->xz.next_out = (uint8_t*)buf;
+    s->xz.avail_out = size;
+
+    while (s->xz.avail_out) {
+        lzma_ret ret;
+
+        stream_fill(s);
+
+        s->xz.next_in = s->in + s->in_pos;
+        s->xz.avail_in = s->in_len - s->in_pos;
+
+        ret = lzma_code(&s->xz, s->eof ? LZMA_FINISH : LZMA_RUN);
+        s->in_pos = s->in_len - s->xz.avail_in;
+
+        if (ret == LZMA_STREAM_END) {
+            s->done = 1;
+            break;
+        }
+
+        if (ret != LZMA_OK) {
+            s->error = "corrupt xz data";
+            break;
+        }
+    }
+
+    return (char*)s->xz.next_out - buf;
+}
+#endif
+
+size_t stream_read(sub_stream* s, char* buf, size_t size)
+{
+    size_t n = 0;
+
+    if (!s->fp || s->error || s->done)
+        return 0;
+
+    switch (s->type) {
+#ifdef HAVE_ZLIB
+    case STREAM_GZIP:
+        return read_gzip(s, buf, size);
+#endif
+#ifdef HAVE_LZMA
+    case STREAM_XZ:
+        return read_xz(s, buf, size);
+#endif
+    default:
+        while (n < size && stream_fill(s)) {
+            size_t len = s->in_len - s->in_pos;
+            if (len > size - n)
+                len = size - n;
+            memcpy(buf + n, s->in + s->in_pos, len);
+            s->in_pos += len;
+            n += len;
+        }
+        return n;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef _FILEIO_H_
+#define _FILEIO_H_
+
+#include <stdio.h>
+#include "assrender.h"
+
+typedef struct {
+    const char* data;
+    size_t size;
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    void* mapping;
+#endif
+} mapped_file;
+
+FILE* open_utf8_filename(const char* f, const char* m);
+
+// size and modification time in ns (as fine as the file system keeps it),
+// used to tell whether a file changed
+int file_stat(const char* filename, long long* size, long long* mtime);
+
+// maps the whole file read-only, an empty file gives size 0 and data ""
+int map_file(const char* filename, mapped_file* mf);
+void unmap_file(mapped_file* mf);
+
+// sequential reader that transparently inflates gzip and xz files
+typedef struct sub_stream sub_stream;
+
+sub_stream* stream_open(const char* filename);
+void stream_close(sub_stream* s);
+
+int stream_compressed(const sub_stream* s);
+// returns the number of bytes read, 0 at the end of the stream or on error
+size_t stream_read(sub_stream* s, char* buf, size_t size);
+// NULL unless opening or decoding failed
+const char* stream_error(const sub_stream* s);
+
+#endif
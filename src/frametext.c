@@ -0,0 +1,545 @@
+#include "frametext.h"
+
+static int reserve(udata* ud, size_t len)
+{
+    if (len > ud->text_cap) {
+        size_t cap = ud->text_cap ? ud->text_cap : 256;
+        char* tmp;
+
+        while (cap < len)
+            cap *= 2;
+
+        tmp = realloc(ud->text_buf, cap);
+        if (!tmp)
+            return 0;
+
+        ud->text_buf = tmp;
+        ud->text_cap = cap;
+    }
+
+    return 1;
+}
+
+static int append(udata* ud, size_t* len, const char* s, size_t n)
+{
+    if (!reserve(ud, *len + n + 1))
+        return 0;
+
+    memcpy(ud->text_buf + *len, s, n);
+    *len += n;
+
+    return 1;
+}
+
+static int append_prop(udata* ud, size_t* len, const char* name, const VSMap* props, const VSAPI* vsapi)
+{
+    char v[64];
+    int err = 0;
+
+    // arrays show their first element, missing properties show nothing
+    switch (vsapi->propGetType(props, name)) {
+    case ptInt:
+        snprintf(v, sizeof(v), "%" PRId64, vsapi->propGetInt(props, name, 0, &err));
+        break;
+    case ptFloat:
+        snprintf(v, sizeof(v), "%g", vsapi->propGetFloat(props, name, 0, &err));
+        break;
+    case ptData: {
+        const char* data = vsapi->propGetData(props, name, 0, &err);
+        int size = vsapi->propGetDataSize(props, name, 0, &err);
+        return err || append(ud, len, data, size);
+    }
+    default:
+        return 1;
+    }
+
+    return err || append(ud, len, v, strlen(v));
+}
+
+const char* format_frame_text(udata* ud, int n, int64_t ts, const VSMap* props, const VSAPI* vsapi)
+{
+    const char* p = ud->frame_text;
+    size_t len = 0;
+    char v[64];
+
+    if (!reserve(ud, 1))
+        return NULL;
+
+    while (*p) {
+        const char* close;
+
+        if (*p == '\n') {
+            if (!append(ud, &len, "\\N", 2))
+                return NULL;
+            p++;
+            continue;
+        }
+
+        if (*p != '{' || !(close = strchr(p, '}'))) {
+            size_t run = strcspn(p + 1, "{\n") + 1;
+            if (!append(ud, &len, p, run))
+                return NULL;
+            p += run;
+            continue;
+        }
+
+        size_t name_len = close - p - 1;
+        const char* name = p + 1;
+
+        if (name_len == 1 && *name == 'n') {
+            snprintf(v, sizeof(v), "%d", n);
+        }
+        else if (name_len == 2 && !strncmp(name, "ms", 2)) {
+            snprintf(v, sizeof(v), "%" PRId64, ts);
+        }
+        else if (name_len == 4 && !strncmp(name, "time", 4)) {
+            int64_t t = ts < 0 ? 0 : ts;
+            snprintf(v, sizeof(v), "%d:%02d:%02d.%03d",
+                     (int)(t / 3600000), (int)(t / 60000 % 60), (int)(t / 1000 % 60), (int)(t % 1000));
+        }
+        else if (name_len > 5 && name_len < 128 && !strncmp(name, "prop:", 5)) {
+            char key[128];
+
+            memcpy(key, name + 5, name_len - 5);
+            key[name_len - 5] = 0;
+
+            if (!append_prop(ud, &len, key, props, vsapi))
+                return NULL;
+
+            p = close + 1;
+            continue;
+        }
+        else {
+            // an override block or anything else, copied through
+            if (!append(ud, &len, p, 1))
+                return NULL;
+            p++;
+            continue;
+        }
+
+        if (!append(ud, &len, v, strlen(v)))
+            return NULL;
+
+        p = close + 1;
+    }
+
+    ud->text_buf[len] = 0;
+
+    return ud->text_buf;
+}
+
+int set_frame_text(udata* ud, int n, int64_t ts, const VSMap* props, const VSAPI* vsapi)
+{
+    ASS_Event* event = ud->ass->events;
+    const char* text = format_frame_text(ud, n, ts, props, vsapi);
+    size_t len;
+    char* tmp;
+
+    if (!text || !strcmp(text, event->Text))
+        return 0;
+
+    len = strlen(text);
+    tmp = realloc(event->Text, len + 1);
+    if (!tmp)
+        return 0;
+
+    memcpy(tmp, text, len + 1);
+    event->Text = tmp;
+
+    return 1;
+}
+
+// Glyph cache for FrameText(fast=True). Each glyph is rendered once through
+// libass on a scratch track and kept as its fill, outline and shadow bitmaps
+// relative to the pen position; frames are then drawn from these without
+// calling ass_render_frame. Only plain single-style text takes this path.
+
+typedef struct {
+    uint8_t* bitmap;
+    int x, y, w, h;
+} glyph_layer;
+
+typedef struct {
+    uint32_t cp;
+    int advance;
+    glyph_layer layer[3]; // indexed by ASS_Image type
+} glyph;
+
+struct glyph_cache {
+    ASS_Track* track;
+    ASS_Renderer* renderer;
+    int width, height;
+    int pos_x, pos_y;
+    glyph* glyphs;
+    int nglyphs, cap;
+    int ascii[128];
+    uint32_t color[3];
+    int layers; // bit per image type any glyph has
+    // layout of an unpositioned line, measured on "c"
+    int ref_right, ref_advance;
+    int origin_x, origin_y, line_step;
+    double fx, fy;
+    // per frame layer canvases and the image list built from them
+    uint8_t* canvas[3];
+    size_t canvas_cap;
+    ASS_Image images[3];
+};
+
+typedef struct {
+    int x0, y0, x1, y1;
+} ink_box;
+
+static ASS_Image* scratch_render(glyph_cache* gc, const char* text, size_t len, int positioned, ink_box* box)
+{
+    ASS_Event* event = gc->track->events;
+    char* tmp = malloc(len + 48);
+    ASS_Image* img;
+    int changed;
+
+    if (!tmp)
+        return NULL;
+
+    if (positioned)
+        snprintf(tmp, 48, "{\\an7\\pos(%d,%d)}", gc->pos_x, gc->pos_y);
+    else
+        tmp[0] = 0;
+    strncat(tmp, text, len);
+
+    free(event->Text);
+    event->Text = tmp;
+
+    img = ass_render_frame(gc->renderer, gc->track, 0, &changed);
+
+    box->x0 = box->y0 = INT_MAX;
+    box->x1 = box->y1 = INT_MIN;
+    for (ASS_Image* i = img; i; i = i->next) {
+        if (i->w == 0 || i->h == 0)
+            continue;
+        if (i->dst_x < box->x0) box->x0 = i->dst_x;
+        if (i->dst_y < box->y0) box->y0 = i->dst_y;
+        if (i->dst_x + i->w > box->x1) box->x1 = i->dst_x + i->w;
+        if (i->dst_y + i->h > box->y1) box->y1 = i->dst_y + i->h;
+    }
+
+    return img;
+}
+
+static int empty_box(const ink_box* box)
+{
+    return box->x1 <= box->x0;
+}
+
+// max of two overlapping coverage bitmaps, close to what libass gets by
+// rasterizing neighbouring glyphs together
+static void merge_bitmap(uint8_t* dst, int dst_stride, const uint8_t* src, int src_stride, int w, int h)
+{
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++)
+            if (src[j] > dst[j])
+                dst[j] = src[j];
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static glyph* add_glyph(glyph_cache* gc, uint32_t cp, const char* s, size_t len)
+{
+    char pair[16];
+    ink_box box, pair_box;
+    ASS_Image* img;
+    glyph* g;
+
+    if (gc->nglyphs == gc->cap) {
+        glyph* tmp = realloc(gc->glyphs, (gc->cap + 32) * sizeof(glyph));
+        if (!tmp)
+            return NULL;
+        gc->glyphs = tmp;
+        gc->cap += 32;
+    }
+
+    g = gc->glyphs + gc->nglyphs;
+    memset(g, 0, sizeof(glyph));
+    g->cp = cp;
+
+    // advance from how far it pushes a following "c"
+    memcpy(pair, s, len);
+    pair[len] = 'c';
+    scratch_render(gc, pair, len + 1, 1, &pair_box);
+    g->advance = empty_box(&pair_box) ? 0 : pair_box.x1 - gc->ref_right;
+
+    img = scratch_render(gc, s, len, 1, &box);
+
+    for (int t = 0; t < 3; t++) {
+        ink_box lb = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+        glyph_layer* l = g->layer + t;
+
+        for (ASS_Image* i = img; i; i = i->next) {
+            if ((int)i->type != t || i->w == 0 || i->h == 0)
+                continue;
+            if (i->dst_x < lb.x0) lb.x0 = i->dst_x;
+            if (i->dst_y < lb.y0) lb.y0 = i->dst_y;
+            if (i->dst_x + i->w > lb.x1) lb.x1 = i->dst_x + i->w;
+            if (i->dst_y + i->h > lb.y1) lb.y1 = i->dst_y + i->h;
+            gc->color[t] = i->color;
+        }
+
+        if (empty_box(&lb))
+            continue;
+
+        l->x = lb.x0 - gc->pos_x;
+        l->y = lb.y0 - gc->pos_y;
+        l->w = lb.x1 - lb.x0;
+        l->h = lb.y1 - lb.y0;
+        l->bitmap = calloc(l->w * l->h, 1);
+        if (!l->bitmap)
+            return NULL;
+        gc->layers |= 1 << t;
+
+        for (ASS_Image* i = img; i; i = i->next)
+            if ((int)i->type == t && i->w && i->h)
+                merge_bitmap(l->bitmap + (i->dst_y - lb.y0) * l->w + i->dst_x - lb.x0, l->w,
+                             i->bitmap, i->stride, i->w, i->h);
+    }
+
+    if (cp < 128)
+        gc->ascii[cp] = gc->nglyphs + 1;
+
+    return gc->glyphs + gc->nglyphs++;
+}
+
+static glyph* find_glyph(glyph_cache* gc, uint32_t cp, const char* s, size_t len)
+{
+    if (cp < 128) {
+        if (gc->ascii[cp])
+            return gc->glyphs + gc->ascii[cp] - 1;
+    }
+    else {
+        for (int i = 0; i < gc->nglyphs; i++)
+            if (gc->glyphs[i].cp == cp)
+                return gc->glyphs + i;
+    }
+
+    return add_glyph(gc, cp, s, len);
+}
+
+static double snap_half(double v)
+{
+    v = floor(v * 2 + 0.5) / 2;
+    return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+glyph_cache* new_glyph_cache(ASS_Track* track, ASS_Renderer* renderer, int width, int height)
+{
+    glyph_cache* gc = calloc(1, sizeof(glyph_cache));
+    ink_box c, cc, c2, pc, pcc, pc2;
+
+    if (!gc)
+        return NULL;
+
+    gc->track = track;
+    gc->renderer = renderer;
+    gc->width = width;
+    gc->height = height;
+    gc->pos_x = width / 8;
+    gc->pos_y = height / 8;
+
+    // where and how a line is placed without \pos, and how far lines are apart
+    scratch_render(gc, "c", 1, 1, &pc);
+    scratch_render(gc, "cc", 2, 1, &pcc);
+    scratch_render(gc, "c\\Nc", 4, 1, &pc2);
+    scratch_render(gc, "c", 1, 0, &c);
+    scratch_render(gc, "cc", 2, 0, &cc);
+    scratch_render(gc, "c\\Nc", 4, 0, &c2);
+
+    if (empty_box(&pc) || empty_box(&pcc) || empty_box(&pc2) || empty_box(&c) || empty_box(&cc) || empty_box(&c2)) {
+        free_glyph_cache(gc);
+        return NULL;
+    }
+
+    gc->ref_right = pc.x1;
+    gc->ref_advance = pcc.x1 - pc.x1;
+    gc->line_step = pc2.y1 - pc.y1;
+    gc->origin_x = c.x0 - (pc.x0 - gc->pos_x);
+    gc->origin_y = c.y0 - (pc.y0 - gc->pos_y);
+    gc->fx = gc->ref_advance ? snap_half((double)(c.x0 - cc.x0) / gc->ref_advance) : 0;
+    gc->fy = gc->line_step ? snap_half((double)(c.y0 - c2.y0) / gc->line_step) : 0;
+
+    return gc;
+}
+
+void free_glyph_cache(glyph_cache* gc)
+{
+    if (!gc)
+        return;
+
+    for (int i = 0; i < gc->nglyphs; i++)
+        for (int t = 0; t < 3; t++)
+            free(gc->glyphs[i].layer[t].bitmap);
+
+    free(gc->glyphs);
+    for (int t = 0; t < 3; t++)
+        free(gc->canvas[t]);
+    ass_free_track(gc->track);
+    free(gc);
+}
+
+static uint32_t next_cp(const char** s)
+{
+    const unsigned char* p = (const unsigned char*)*s;
+    uint32_t cp = *p++;
+    int extra = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+
+    if (extra) {
+        cp &= 0x3F >> extra;
+        while (extra-- && (*p & 0xC0) == 0x80)
+            cp = (cp << 6) | (*p++ & 0x3F);
+    }
+
+    *s = (const char*)p;
+
+    return cp;
+}
+
+int render_glyphs(glyph_cache* gc, const char* text, ASS_Image** out)
+{
+    ink_box box = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+    int lines = 1, line, pen_x, pen_y;
+    int widths[64];
+    const char* p;
+
+    // plain text and \N only, anything else goes through libass
+    for (p = text; *p; p++) {
+        if (*p == '{')
+            return 0;
+        if (*p == '\\') {
+            if (p[1] != 'N')
+                return 0;
+            lines++;
+            p++;
+        }
+    }
+
+    if (lines > 64)
+        return 0;
+
+    // line widths, which also fills the cache
+    memset(widths, 0, sizeof(widths));
+    for (p = text, line = 0; *p; ) {
+        const char* s = p;
+        uint32_t cp;
+        glyph* g;
+
+        if (*p == '\\') {
+            line++;
+            p += 2;
+            continue;
+        }
+
+        cp = next_cp(&p);
+        g = find_glyph(gc, cp, s, p - s);
+        if (!g)
+            return 0;
+        widths[line] += g->advance;
+    }
+
+    // two passes over the glyphs: the ink box, then drawing into it
+    for (int pass = 0; pass < 2; pass++) {
+        pen_y = gc->origin_y - (int)(gc->fy * (lines - 1) * gc->line_step);
+        pen_x = gc->origin_x + (int)(gc->fx * (gc->ref_advance - widths[0]));
+
+        if (pass) {
+            size_t size;
+
+            if (box.x0 < 0) box.x0 = 0;
+            if (box.y0 < 0) box.y0 = 0;
+            if (box.x1 > gc->width) box.x1 = gc->width;
+            if (box.y1 > gc->height) box.y1 = gc->height;
+
+            if (empty_box(&box) || box.y1 <= box.y0) {
+                *out = NULL;
+                return 1;
+            }
+
+            size = (size_t)(box.x1 - box.x0) * (box.y1 - box.y0);
+            if (size > gc->canvas_cap) {
+                for (int t = 0; t < 3; t++) {
+                    free(gc->canvas[t]);
+                    gc->canvas[t] = malloc(size);
+                    if (!gc->canvas[t]) {
+                        gc->canvas_cap = 0;
+                        return 0;
+                    }
+                }
+                gc->canvas_cap = size;
+            }
+            for (int t = 0; t < 3; t++)
+                memset(gc->canvas[t], 0, size);
+        }
+
+        for (p = text, line = 0; *p; ) {
+            const char* s = p;
+            glyph* g;
+
+            if (*p == '\\') {
+                line++;
+                p += 2;
+                pen_y += gc->line_step;
+                pen_x = gc->origin_x + (int)(gc->fx * (gc->ref_advance - widths[line]));
+                continue;
+            }
+
+            g = find_glyph(gc, next_cp(&p), s, p - s);
+
+            for (int t = 0; t < 3; t++) {
+                glyph_layer* l = g->layer + t;
+                int x0 = pen_x + l->x, y0 = pen_y + l->y;
+
+                if (!l->bitmap)
+                    continue;
+
+                if (!pass) {
+                    if (x0 < box.x0) box.x0 = x0;
+                    if (y0 < box.y0) box.y0 = y0;
+                    if (x0 + l->w > box.x1) box.x1 = x0 + l->w;
+                    if (y0 + l->h > box.y1) box.y1 = y0 + l->h;
+                }
+                else {
+                    // clip against the canvas, which is clipped to the frame
+                    int sx = x0 < box.x0 ? box.x0 - x0 : 0;
+                    int sy = y0 < box.y0 ? box.y0 - y0 : 0;
+                    int w = (x0 + l->w < box.x1 ? x0 + l->w : box.x1) - x0 - sx;
+                    int h = (y0 + l->h < box.y1 ? y0 + l->h : box.y1) - y0 - sy;
+                    int stride = box.x1 - box.x0;
+
+                    if (w > 0 && h > 0)
+                        merge_bitmap(gc->canvas[t] + (y0 + sy - box.y0) * stride + x0 + sx - box.x0, stride,
+                                     l->bitmap + sy * l->w + sx, l->w, w, h);
+                }
+            }
+
+            pen_x += g->advance;
+        }
+    }
+
+    // same order libass uses: shadow, outline, then the fill on top
+    *out = NULL;
+    for (int t = 0; t < 3; t++) {
+        ASS_Image* img = gc->images + t;
+
+        if (!(gc->layers & (1 << t)))
+            continue;
+
+        img->w = box.x1 - box.x0;
+        img->h = box.y1 - box.y0;
+        img->stride = img->w;
+        img->bitmap = gc->canvas[t];
+        img->color = gc->color[t];
+        img->dst_x = box.x0;
+        img->dst_y = box.y0;
+        img->type = t;
+        img->next = *out;
+        *out = img;
+    }
+
+    return 1;
+}
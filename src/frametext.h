@@ -0,0 +1,24 @@
+#ifndef _FRAMETEXT_H_
+#define _FRAMETEXT_H_
+
+#include "assrender.h"
+
+// expands {n}, {time}, {ms} and {prop:Name} in the template into ud->text_buf;
+// anything else, override tags included, is copied as is and newlines become \N
+const char* format_frame_text(udata* ud, int n, int64_t ts, const VSMap* props, const VSAPI* vsapi);
+
+// puts the text for frame n into the track's single event, returns 1 if it changed
+int set_frame_text(udata* ud, int n, int64_t ts, const VSMap* props, const VSAPI* vsapi);
+
+// glyphs rendered once through libass on the given scratch track
+// (same style and size as the real one), which the cache takes over
+typedef struct glyph_cache glyph_cache;
+
+glyph_cache* new_glyph_cache(ASS_Track* track, ASS_Renderer* renderer, int width, int height);
+void free_glyph_cache(glyph_cache* gc);
+
+// builds the image list for text from cached glyphs, returns 0 when the
+// text has override tags or anything else that needs libass
+int render_glyphs(glyph_cache* gc, const char* text, ASS_Image** out);
+
+#endif
@@ -1,4 +1,9 @@
 #include "render.h"
+#include "buckets.h"
+#include "timecodes.h"
+#include "frametext.h"
+#include "stats.h"
+#include "trace.h"
 
 // Kg is not parameter, calculated from Kr and Kb
 static void BuildMatrix(ConversionMatrix* matrix, double Kr, double Kb, int shift, int full_scale, int bits_per_pixel)
@@ -94,7 +99,7 @@ inline void col2yuv(uint32_t* c, uint8_t* y, uint8_t* u, uint8_t* v, ConversionM
   *v = div65536(m->v_r * _r(*c) + m->v_g * _g(*c) + m->v_b * _b(*c)) + 128;
 }
 
-void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_per_pixel, int rgb, ConversionMatrix* mx)
+void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int x0, int y0, int bits_per_pixel, int rgb, ConversionMatrix* mx)
 {
     uint8_t c1, c2, c3, a, a1;
     uint8_t* src;
@@ -116,10 +121,10 @@ void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_pe
         a1 = 255 - _a(img->color); // transparency
 
         src = img->bitmap;
-        dstC1 = sub_img[1] + img->dst_y * width + img->dst_x;
-        dstC2 = sub_img[2] + img->dst_y * width + img->dst_x;
-        dstC3 = sub_img[3] + img->dst_y * width + img->dst_x;
-        dstA = sub_img[0] + img->dst_y * width + img->dst_x;
+        dstC1 = sub_img[1] + (img->dst_y - y0) * width + img->dst_x - x0;
+        dstC2 = sub_img[2] + (img->dst_y - y0) * width + img->dst_x - x0;
+        dstC3 = sub_img[3] + (img->dst_y - y0) * width + img->dst_x - x0;
+        dstA = sub_img[0] + (img->dst_y - y0) * width + img->dst_x - x0;
 
         for (int i = 0; i < img->h; i++) {
             for (int j = 0; j < img->w; j++) {
@@ -151,7 +156,7 @@ void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_pe
     }
 }
 
-void make_sub_img16(ASS_Image* img, uint8_t** sub_img0, uint32_t width, int bits_per_pixel, int rgb, ConversionMatrix *mx)
+void make_sub_img16(ASS_Image* img, uint8_t** sub_img0, uint32_t width, int x0, int y0, int bits_per_pixel, int rgb, ConversionMatrix *mx)
 {
   uint16_t** sub_img = (uint16_t**)sub_img0;
 
@@ -193,10 +198,10 @@ void make_sub_img16(ASS_Image* img, uint8_t** sub_img0, uint32_t width, int bits
 
     src = img->bitmap; // always 8 bits
     // dst 1..3 is real bit depth 0 (alpha) is 8 bits
-    dstC1 = sub_img[1] + img->dst_y * width + img->dst_x;
-    dstC2 = sub_img[2] + img->dst_y * width + img->dst_x;
-    dstC3 = sub_img[3] + img->dst_y * width + img->dst_x;
-    dstA = sub_img[0] + img->dst_y * width + img->dst_x;
+    dstC1 = sub_img[1] + (img->dst_y - y0) * width + img->dst_x - x0;
+    dstC2 = sub_img[2] + (img->dst_y - y0) * width + img->dst_x - x0;
+    dstC3 = sub_img[3] + (img->dst_y - y0) * width + img->dst_x - x0;
+    dstA = sub_img[0] + (img->dst_y - y0) * width + img->dst_x - x0;
 
     for (int i = 0; i < img->h; i++) {
       for (int j = 0; j < img->w; j++) {
@@ -906,6 +911,456 @@ void apply_y(uint8_t** sub_img_8, uint8_t** data_8, int32_t* pitch, uint32_t wid
   }
 }
 
+// Start time in ms from the frame itself: _AbsoluteTime when the source
+// has it, otherwise the clip rate. A frame's own duration says nothing about
+// the ones before it, so a variable rate clip without _AbsoluteTime fails.
+static int frame_time_props(const VSMap* props, int n, const VSVideoInfo* vi, const VSAPI* vsapi, int64_t* ts)
+{
+    int err = 0;
+    double abs_time = vsapi->propGetFloat(props, "_AbsoluteTime", 0, &err);
+
+    if (!err) {
+        *ts = (int64_t)(abs_time * 1000.0 + 0.5);
+        return 1;
+    }
+
+    if (vi->fpsNum > 0 && vi->fpsDen > 0) {
+        *ts = (int64_t)n * 1000 * vi->fpsDen / vi->fpsNum;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Anything that makes an event look different from one render time to
+// the next: \t, \move, \fad(e), karaoke and the scrolling effects.
+// Matches tag names anywhere in the text, a false hit only costs speed.
+static int event_animated(const ASS_Event* event)
+{
+    const char* p = event->Text;
+
+    if (event->Effect && *event->Effect)
+        return 1;
+
+    while (p && (p = strchr(p, '\\')) != NULL) {
+        p++;
+        if (*p == 't' || *p == 'k' || *p == 'K' ||
+            !strncmp(p, "move", 4) || !strncmp(p, "fad", 3))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int cmp_ts(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// index of the last change point at or before ts, -1 if there is none
+static int find_change_point(const udata* ud, int64_t ts)
+{
+    int lo = -1, hi = ud->nchange_points - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (ud->change_points[mid] <= ts)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+void build_static_intervals(udata* ud)
+{
+    ASS_Track* track = ud->ass;
+    int n = 0;
+    int* depth;
+
+    free(ud->change_points);
+    free(ud->animated);
+    ud->change_points = NULL;
+    ud->animated = NULL;
+    ud->nchange_points = 0;
+
+    if (!track->n_events)
+        return;
+
+    ud->change_points = malloc(2 * track->n_events * sizeof(int64_t));
+    if (!ud->change_points)
+        return;
+
+    for (int i = 0; i < track->n_events; i++) {
+        ud->change_points[n++] = track->events[i].Start;
+        ud->change_points[n++] = track->events[i].Start + track->events[i].Duration;
+    }
+
+    qsort(ud->change_points, n, sizeof(int64_t), cmp_ts);
+
+    int unique = 1;
+    for (int i = 1; i < n; i++)
+        if (ud->change_points[i] != ud->change_points[unique - 1])
+            ud->change_points[unique++] = ud->change_points[i];
+    ud->nchange_points = unique;
+
+    // count the animated events over each interval, as a difference array
+    ud->animated = calloc(unique, 1);
+    depth = calloc(unique + 1, sizeof(int));
+    if (!ud->animated || !depth) {
+        free(depth);
+        free(ud->change_points);
+        free(ud->animated);
+        ud->change_points = NULL;
+        ud->animated = NULL;
+        ud->nchange_points = 0;
+        return;
+    }
+
+    for (int i = 0; i < track->n_events; i++) {
+        ASS_Event* event = track->events + i;
+
+        if (event->Duration > 0 && event_animated(event)) {
+            depth[find_change_point(ud, event->Start)]++;
+            depth[find_change_point(ud, event->Start + event->Duration)]--;
+        }
+    }
+
+    for (int i = 0, d = 0; i < unique; i++) {
+        d += depth[i];
+        ud->animated[i] = d > 0;
+    }
+
+    free(depth);
+}
+
+// the time range around ts in which the rendered picture can't change
+static void static_interval(const udata* ud, int64_t ts, int64_t* start, int64_t* end)
+{
+    int i;
+
+    // libass time is in whole milliseconds, the same ts is the same picture
+    if (!ud->change_points) {
+        // no analysis, only the same time can be reused
+        *start = ts;
+        *end = ts + 1;
+        return;
+    }
+
+    i = find_change_point(ud, ts);
+
+    if (i >= 0 && ud->animated[i]) {
+        *start = ts;
+        *end = ts + 1;
+        return;
+    }
+
+    *start = i >= 0 ? ud->change_points[i] : INT64_MIN;
+    *end = i + 1 < ud->nchange_points ? ud->change_points[i + 1] : INT64_MAX;
+}
+
+// bounding box of the images, widened to whole chroma samples
+static void overlay_bbox(ASS_Image* img, int ssw, int ssh, int width, int height, udata* ud)
+{
+    int x0 = width, y0 = height, x1 = 0, y1 = 0;
+
+    ud->overlay_images = 0;
+    ud->overlay_area = 0;
+
+    for (; img; img = img->next) {
+        if (img->w == 0 || img->h == 0)
+            continue;
+        ud->overlay_images++;
+        ud->overlay_area += (int64_t)img->w * img->h;
+        if (img->dst_x < x0) x0 = img->dst_x;
+        if (img->dst_y < y0) y0 = img->dst_y;
+        if (img->dst_x + img->w > x1) x1 = img->dst_x + img->w;
+        if (img->dst_y + img->h > y1) y1 = img->dst_y + img->h;
+    }
+
+    if (x1 <= x0 || y1 <= y0) {
+        ud->bbox_x = ud->bbox_y = ud->bbox_w = ud->bbox_h = 0;
+        return;
+    }
+
+    x0 &= ~((1 << ssw) - 1);
+    y0 &= ~((1 << ssh) - 1);
+    x1 = (x1 + (1 << ssw) - 1) & ~((1 << ssw) - 1);
+    y1 = (y1 + (1 << ssh) - 1) & ~((1 << ssh) - 1);
+
+    ud->bbox_x = x0;
+    ud->bbox_y = y0;
+    ud->bbox_w = (x1 < width ? x1 : width) - x0;
+    ud->bbox_h = (y1 < height ? y1 : height) - y0;
+}
+
+// the renderer, the overlay and their bookkeeping are shared by all frames
+// in flight, returns how long this thread waited for them
+static int64_t lock_renderer(udata* ud, int n)
+{
+    int64_t t0 = monotonic_ns();
+
+    counter_inc(&ud->ahead_waiting);
+    mutex_lock(&ud->lock);
+    counter_dec(&ud->ahead_waiting);
+
+    // the worker may have stepped aside for this request, it can go on
+    // once the lock is free again
+    if (ud->lookahead)
+        cond_signal(&ud->ahead_cond);
+
+    int64_t t1 = monotonic_ns();
+
+    trace_span(ud->trace, "wait", ud->stats ? ud->stats->id : 0, n, t0, t1, -1);
+
+    return t1 - t0;
+}
+
+// time of frame n, unless it comes from the frame's properties
+static int64_t frame_time(const udata* ud, const VSVideoInfo* vi, int n)
+{
+    if (ud->isvfr)
+        return timecodes_get(ud->tc, n);
+
+    // it’s a casting party!
+    return (int64_t)n * (int64_t)1000 * (int64_t)vi->fpsDen / (int64_t)vi->fpsNum;
+}
+
+// renders and composites the current overlay for ts, with the lock held;
+// returns what libass said changed
+static int update_overlay(udata* ud, int64_t ts, int n, render_stats* frame)
+{
+    const VSFormat* fmt = ud->vi->format;
+    const int id = ud->stats ? ud->stats->id : 0;
+    ASS_Image* img;
+    int changed = 0;
+    int64_t t0 = monotonic_ns(), t1;
+
+    if (ud->glyphs && render_glyphs(ud->glyphs, ud->ass->events->Text, &img))
+        changed = 2;
+    else {
+        img = ass_render_frame(ud->ass_renderer, ud->buckets ? bucket_track(ud->buckets, ts) : ud->ass, ts, &changed);
+        frame->libass_same += changed == 0;
+        frame->libass_moved += changed == 1;
+        frame->libass_new += changed == 2;
+
+        // changed is relative to libass's previous render, which may have
+        // gone into a lookahead slot instead of this overlay
+        if (ud->last_composite != ud->sub_img[0])
+            changed = 2;
+        ud->last_composite = ud->sub_img[0];
+    }
+
+    t1 = monotonic_ns();
+    trace_span(ud->trace, "render", id, n, t0, t1, -1);
+    frame->render_ns += t1 - t0;
+    frame->frames_rendered = 1;
+
+    if (changed || !ud->rendered) {
+        overlay_bbox(img, fmt->subSamplingW, fmt->subSamplingH, ud->vi->width, ud->vi->height, ud);
+
+        if (ud->bbox_w) {
+            memset(ud->sub_img[0], 0x00, ud->bbox_w * ud->bbox_h * ud->pixelsize);
+            ud->f_make_sub_img(img, ud->sub_img, ud->bbox_w, ud->bbox_x, ud->bbox_y, ud->bits_per_pixel, ud->rgb_fullscale, &ud->mx);
+        }
+
+        t0 = monotonic_ns();
+        trace_span(ud->trace, "composite", id, n, t1, t0, -1);
+        frame->composite_ns += t0 - t1;
+    }
+
+    ud->rendered = 1;
+    static_interval(ud, ts, &ud->static_start, &ud->static_end);
+
+    return changed;
+}
+
+static void swap_overlay(udata* ud, lookahead_slot* slot)
+{
+    lookahead_slot cur = {
+        ud->rendered, { ud->sub_img[0], ud->sub_img[1], ud->sub_img[2], ud->sub_img[3] },
+        ud->bbox_x, ud->bbox_y, ud->bbox_w, ud->bbox_h,
+        ud->overlay_images, ud->overlay_area, ud->static_start, ud->static_end, slot->changed
+    };
+
+    ud->rendered = slot->rendered;
+    memcpy(ud->sub_img, slot->sub_img, sizeof(ud->sub_img));
+    ud->bbox_x = slot->bbox_x;
+    ud->bbox_y = slot->bbox_y;
+    ud->bbox_w = slot->bbox_w;
+    ud->bbox_h = slot->bbox_h;
+    ud->overlay_images = slot->overlay_images;
+    ud->overlay_area = slot->overlay_area;
+    ud->static_start = slot->static_start;
+    ud->static_end = slot->static_end;
+
+    *slot = cur;
+}
+
+static lookahead_slot* find_slot(udata* ud, int64_t ts)
+{
+    for (int i = 0; i < ud->lookahead; i++) {
+        lookahead_slot* slot = ud->slots + i;
+
+        if (slot->rendered && ts >= slot->static_start && ts < slot->static_end)
+            return slot;
+    }
+
+    return NULL;
+}
+
+// the render time after the last frame of the window
+static int64_t window_end(const udata* ud)
+{
+    const int end = ud->ahead_next + ud->lookahead;
+
+    return end < ud->vi->numFrames ? frame_time(ud, ud->vi, end) : INT64_MAX;
+}
+
+// the window follows the requests whichever way they go, slots left
+// outside it are freed rather than kept for a frame that may never come
+static void move_window(udata* ud, int n, int64_t ts)
+{
+    ud->ahead_next = n + 1;
+
+    const int64_t end = window_end(ud);
+
+    for (int i = 0; i < ud->lookahead; i++)
+        if (ud->slots[i].static_end <= ts || ud->slots[i].static_start >= end)
+            ud->slots[i].rendered = 0;
+}
+
+static void* lookahead_worker(void* arg)
+{
+    udata* ud = arg;
+    const int id = ud->stats ? ud->stats->id : 0;
+
+    mutex_lock(&ud->lock);
+
+    while (!ud->ahead_stop) {
+        // nothing asked for yet, or a request wants the renderer
+        if (ud->ahead_next < 0 || counter_get(&ud->ahead_waiting)) {
+            cond_wait(&ud->ahead_cond, &ud->lock);
+            continue;
+        }
+
+        const int first = ud->ahead_next < ud->vi->numFrames ? ud->ahead_next : ud->vi->numFrames - 1;
+        const int64_t window = frame_time(ud, ud->vi, first);
+        lookahead_slot* slot = NULL;
+        int target = -1;
+        int64_t ts = 0;
+
+        // the first frame of the window nothing has been rendered for yet
+        for (int m = first; m < ud->ahead_next + ud->lookahead && m < ud->vi->numFrames; m++) {
+            ts = frame_time(ud, ud->vi, m);
+            if ((ud->rendered && ts >= ud->static_start && ts < ud->static_end) || find_slot(ud, ts))
+                continue;
+            target = m;
+            break;
+        }
+
+        // free slots and those outside the window can be reused
+        const int64_t end = window_end(ud);
+
+        for (int i = 0; target >= 0 && !slot && i < ud->lookahead; i++)
+            if (!ud->slots[i].rendered || ud->slots[i].static_end <= window || ud->slots[i].static_start >= end)
+                slot = ud->slots + i;
+
+        if (!slot) {
+            cond_wait(&ud->ahead_cond, &ud->lock);
+            continue;
+        }
+
+        render_stats frame = { 0 };
+        int64_t start = monotonic_ns();
+
+        slot->rendered = 0;
+        swap_overlay(ud, slot);
+        int changed = update_overlay(ud, ts, target, &frame);
+        swap_overlay(ud, slot);
+        slot->changed = changed;
+
+        frame.frames_rendered = 0;
+        frame.lookahead_renders = 1;
+        stats_add(ud->stats, &frame);
+        trace_span(ud->trace, "lookahead", id, target, start, monotonic_ns(), -1);
+
+        // a request that came in meanwhile gets the renderer first
+        mutex_unlock(&ud->lock);
+        mutex_lock(&ud->lock);
+    }
+
+    mutex_unlock(&ud->lock);
+
+    return NULL;
+}
+
+static void free_slots(udata* ud)
+{
+    for (int i = 0; i < ud->lookahead; i++)
+        for (int p = 0; p < 4; p++)
+            free(ud->slots[i].sub_img[p]);
+    free(ud->slots);
+    ud->slots = NULL;
+    ud->lookahead = 0;
+}
+
+int start_lookahead(udata* ud, const VSVideoInfo* vi, int frames)
+{
+    const size_t size = (size_t)vi->width * vi->height * ud->pixelsize;
+
+    ud->vi = vi;
+    ud->lookahead = frames;
+    ud->ahead_next = -1;
+    ud->ahead_stop = 0;
+    ud->ahead_waiting = 0;
+
+    if (!frames)
+        return 1;
+
+    ud->slots = calloc(frames, sizeof(lookahead_slot));
+    if (!ud->slots) {
+        ud->lookahead = 0;
+        return 0;
+    }
+
+    for (int i = 0; i < frames; i++) {
+        for (int p = 0; p < 4; p++) {
+            if (!(ud->slots[i].sub_img[p] = malloc(size))) {
+                free_slots(ud);
+                return 0;
+            }
+        }
+    }
+
+    cond_init(&ud->ahead_cond);
+
+    if (thread_create(&ud->ahead_thread, lookahead_worker, ud)) {
+        cond_destroy(&ud->ahead_cond);
+        free_slots(ud);
+        return 0;
+    }
+
+    return 1;
+}
+
+void stop_lookahead(udata* ud)
+{
+    if (!ud->slots)
+        return;
+
+    mutex_lock(&ud->lock);
+    ud->ahead_stop = 1;
+    cond_signal(&ud->ahead_cond);
+    mutex_unlock(&ud->lock);
+
+    thread_join(ud->ahead_thread);
+    cond_destroy(&ud->ahead_cond);
+    free_slots(ud);
+}
+
 const VSFrameRef* VS_CC assrender_get_frame_vs(int n, int activationReason, void** instanceData, void** frameData, VSFrameContext* frameCtx, VSCore* core, const VSAPI* vsapi) {
     const VS_FilterInfo* p = *instanceData;
     if (activationReason == arInitial) {
@@ -913,62 +1368,135 @@ const VSFrameRef* VS_CC assrender_get_frame_vs(int n, int activationReason, void
     }
     else if (activationReason == arAllFramesReady) {
         udata* ud = (udata*)p->user_data;
-        ASS_Image* img;
+        const VSFormat* fmt = p->vi->format;
+        const int id = ud->stats ? ud->stats->id : 0;
+        const int planes = fmt->colorFamily != cmCompat && !ud->greyscale ? 3 : 1;
+        VSFrameRef* dst = NULL;
 
-        int64_t ts;
-        int changed;
+        render_stats frame = { 0 };
+        int64_t ts, t0, t1, wait;
+        int64_t start = monotonic_ns();
+        int changed = 0;
 
         const VSFrameRef* src = vsapi->getFrameFilter(n, p->node, frameCtx);
-        VSFrameRef *dst = vsapi->copyFrame(src, core);
-        vsapi->freeFrame(src);
 
-        if (!ud->isvfr) {
-            // it’s a casting party!
-            ts = (int64_t)n * (int64_t)1000 * (int64_t)p->vi->fpsDen / (int64_t)p->vi->fpsNum;
+        if (ud->vfr_props) {
+            if (!frame_time_props(vsapi->getFramePropsRO(src), n, p->vi, vsapi, &ts)) {
+                char e[128];
+                snprintf(e, sizeof(e), "AssRender: frame %d of a variable frame rate clip has no _AbsoluteTime", n);
+                vsapi->setFilterError(e, frameCtx);
+                vsapi->freeFrame(src);
+                return NULL;
+            }
         }
         else {
-            ts = ud->timestamp[n];
+            ts = frame_time(ud, p->vi, n);
         }
 
-        img = ass_render_frame(ud->ass_renderer, ud->ass, ts, &changed);
+        wait = lock_renderer(ud, n);
 
-        if (img) {
-            uint32_t height, width, pitch[2];
-            uint8_t* data[3];
+        // the worker moves on to the frames after this one
+        if (ud->lookahead)
+            move_window(ud, n, ts);
 
-            if (p->vi->format->colorFamily != cmCompat && !ud->greyscale) {
-                if (p->vi->format->colorFamily == cmRGB) {
-                    // planar RGB as 444
-                    data[0] = vsapi->getWritePtr(dst, 0);
-                    data[1] = vsapi->getWritePtr(dst, 1);
-                    data[2] = vsapi->getWritePtr(dst, 2);
-                    pitch[0] = vsapi->getStride(dst, 0);
-                }
-                else {
-                    data[0] = vsapi->getWritePtr(dst, 0);
-                    data[1] = vsapi->getWritePtr(dst, 1);
-                    data[2] = vsapi->getWritePtr(dst, 2);
-                    pitch[0] = vsapi->getStride(dst, 0);
-                    pitch[1] = vsapi->getStride(dst, 1);
+        for (;;) {
+            if (ud->frame_text && set_frame_text(ud, n, ts, vsapi->getFramePropsRO(src), vsapi))
+                ud->rendered = 0;
+
+            if (!ud->rendered || ts < ud->static_start || ts >= ud->static_end) {
+                lookahead_slot* slot = ud->lookahead ? find_slot(ud, ts) : NULL;
+
+                if (slot) {
+                    // rendered ahead, take it over and leave the slot free
+                    swap_overlay(ud, slot);
+                    slot->rendered = 0;
+                    changed = slot->changed;
+                    frame.lookahead_hits = 1;
                 }
+                else
+                    changed = update_overlay(ud, ts, n, &frame);
             }
-            else {
-                data[0] = vsapi->getWritePtr(dst, 0);
-                pitch[0] = vsapi->getStride(dst, 0);
+
+            if (!ud->bbox_w && !ud->frame_stats) {
+                // nothing to draw, the source frame goes out as it is
+                mutex_unlock(&ud->lock);
+                if (dst)
+                    vsapi->freeFrame(dst);
+
+                frame.frames = 1;
+                frame.frames_passed = 1;
+                frame.cache_hits = !frame.frames_rendered && !frame.lookahead_hits;
+                stats_add(ud->stats, &frame);
+                trace_span(ud->trace, "frame", id, n, start, monotonic_ns(), wait);
+
+                return src;
             }
 
-            height = p->vi->height;
-            width = p->vi->width;
+            if (dst)
+                break;
+
+            // copying the frame doesn't need the renderer, let the lookahead
+            // worker in meanwhile and check the overlay again afterwards
+            mutex_unlock(&ud->lock);
+
+            t0 = monotonic_ns();
+            dst = vsapi->copyFrame(src, core);
+            for (int i = 0; i < planes; i++)
+                vsapi->getWritePtr(dst, i);
+            trace_span(ud->trace, "copy", id, n, t0, monotonic_ns(), -1);
+
+            wait += lock_renderer(ud, n);
+        }
+
+        if (ud->bbox_w) {
+            int32_t pitch[3];
+            uint8_t* data[3];
+
+            // blend only the overlay's box
+            for (int i = 0; i < planes; i++) {
+                int ssw = i ? fmt->subSamplingW : 0;
+                int ssh = i ? fmt->subSamplingH : 0;
 
-            if (changed) {
-                memset(ud->sub_img[0], 0x00, height * width * ud->pixelsize);
-                ud->f_make_sub_img(img, ud->sub_img, width, ud->bits_per_pixel, ud->rgb_fullscale, &ud->mx);
+                pitch[i] = vsapi->getStride(dst, i);
+                data[i] = vsapi->getWritePtr(dst, i) +
+                          (ud->bbox_y >> ssh) * pitch[i] + (ud->bbox_x >> ssw) * ud->pixelsize;
             }
 
-            ud->apply(ud->sub_img, data, pitch, width, height);
+            t0 = monotonic_ns();
+            ud->apply(ud->sub_img, data, pitch, ud->bbox_w, ud->bbox_h);
+            t1 = monotonic_ns();
+            trace_span(ud->trace, "blend", id, n, t0, t1, -1);
+            frame.blend_ns = t1 - t0;
         }
 
+        frame.frames = 1;
+        frame.frames_passed = !ud->bbox_w;
+        frame.cache_hits = !frame.frames_rendered && !frame.lookahead_hits;
+        frame.peak_scratch = (int64_t)ud->bbox_w * ud->bbox_h * ud->pixelsize * 4;
+
+        const int images = ud->overlay_images;
+        const int64_t area = ud->overlay_area;
+
+        mutex_unlock(&ud->lock);
+        vsapi->freeFrame(src);
+
+        stats_add(ud->stats, &frame);
+
+        if (ud->frame_stats) {
+            VSMap* props = vsapi->getFramePropsRW(dst);
+
+            vsapi->propSetInt(props, "AssRenderTimeRender", frame.render_ns, paReplace);
+            vsapi->propSetInt(props, "AssRenderTimeComposite", frame.composite_ns, paReplace);
+            vsapi->propSetInt(props, "AssRenderTimeBlend", frame.blend_ns, paReplace);
+            vsapi->propSetInt(props, "AssRenderImages", images, paReplace);
+            vsapi->propSetInt(props, "AssRenderArea", area, paReplace);
+            vsapi->propSetInt(props, "AssRenderChanged", changed, paReplace);
+            vsapi->propSetInt(props, "AssRenderTimeWait", wait, paReplace);
+        }
+
+        trace_span(ud->trace, "frame", id, n, start, monotonic_ns(), wait);
+
         return dst;
     }
     return NULL;
-}
\ No newline at end of file
+}
@@ -26,8 +26,8 @@
 
 void FillMatrix(ConversionMatrix* matrix, matrix_type mt);
 
-void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_per_pixel, int rgb, ConversionMatrix *mx);
-void make_sub_img16(ASS_Image* img, uint8_t** sub_img, uint32_t width, int bits_per_pixel, int rgb, ConversionMatrix* mx);
+void make_sub_img(ASS_Image* img, uint8_t** sub_img, uint32_t width, int x0, int y0, int bits_per_pixel, int rgb, ConversionMatrix *mx);
+void make_sub_img16(ASS_Image* img, uint8_t** sub_img, uint32_t width, int x0, int y0, int bits_per_pixel, int rgb, ConversionMatrix* mx);
 
 void apply_rgba(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t width, uint32_t height);
 void apply_rgb(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t width, uint32_t height);
@@ -45,6 +45,14 @@ void apply_yuv444(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t wi
 void apply_y(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t width, uint32_t height);
 void apply_yv411(uint8_t** sub_img, uint8_t** data, int32_t* pitch, uint32_t width, uint32_t height);
 
+// finds the time ranges where nothing on screen moves, see static_interval
+void build_static_intervals(udata* ud);
+
+// runs a worker rendering up to frames frames ahead of the last request,
+// 0 frames runs none; 0 if the thread or the slots can't be had
+int start_lookahead(udata* ud, const VSVideoInfo* vi, int frames);
+void stop_lookahead(udata* ud);
+
 const VSFrameRef* VS_CC assrender_get_frame_vs(int n, int activationReason, void** instanceData, void** frameData, VSFrameContext* frameCtx, VSCore* core, const VSAPI* vsapi);
 
 #endif
@@ -0,0 +1,151 @@
+#include "stats.h"
+#include "thread.h"
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#include <windows.h>
+
+int64_t monotonic_ns(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    // split to keep the multiplication from overflowing
+    return now.QuadPart / freq.QuadPart * 1000000000 +
+           now.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart;
+}
+#else
+#include <time.h>
+
+int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static render_stats* stats_list = NULL;
+static int stats_next_id = 0;
+static mutex stats_lock = MUTEX_INITIALIZER;
+
+render_stats* stats_register(const char* name)
+{
+    render_stats* st = calloc(1, sizeof(render_stats));
+
+    if (!st)
+        return NULL;
+
+    st->name = strdup(name);
+
+    mutex_lock(&stats_lock);
+    st->id = stats_next_id++;
+    st->next = stats_list;
+    stats_list = st;
+    mutex_unlock(&stats_lock);
+
+    return st;
+}
+
+void stats_unregister(render_stats* st)
+{
+    if (!st)
+        return;
+
+    mutex_lock(&stats_lock);
+    for (render_stats** p = &stats_list; *p; p = &(*p)->next) {
+        if (*p == st) {
+            *p = st->next;
+            break;
+        }
+    }
+    mutex_unlock(&stats_lock);
+
+    free(st->name);
+    free(st);
+}
+
+void stats_add(render_stats* st, const render_stats* frame)
+{
+    if (!st)
+        return;
+
+    mutex_lock(&stats_lock);
+    st->frames += frame->frames;
+    st->frames_rendered += frame->frames_rendered;
+    st->frames_passed += frame->frames_passed;
+    st->cache_hits += frame->cache_hits;
+    st->lookahead_hits += frame->lookahead_hits;
+    st->lookahead_renders += frame->lookahead_renders;
+    st->libass_same += frame->libass_same;
+    st->libass_moved += frame->libass_moved;
+    st->libass_new += frame->libass_new;
+    st->render_ns += frame->render_ns;
+    st->composite_ns += frame->composite_ns;
+    st->blend_ns += frame->blend_ns;
+    if (frame->peak_scratch > st->peak_scratch)
+        st->peak_scratch = frame->peak_scratch;
+    mutex_unlock(&stats_lock);
+}
+
+void stats_print(const render_stats* st)
+{
+    if (!st)
+        return;
+
+    mutex_lock(&stats_lock);
+    fprintf(stderr,
+            "AssRender: %s: %" PRId64 " frames, %" PRId64 " rendered, %" PRId64 " passed through, "
+            "%" PRId64 " reused, %" PRId64 " of %" PRId64 " rendered ahead used; libass %.1f ms, composite %.1f ms, blend %.1f ms; "
+            "peak scratch %" PRId64 " bytes\n"
+            "AssRender: %s: libass returned %" PRId64 " same, %" PRId64 " moved, %" PRId64 " new; "
+            "%s shaper, cache limits %d glyphs, %d MiB of bitmaps (0: libass default)\n",
+            st->name, st->frames, st->frames_rendered, st->frames_passed, st->cache_hits,
+            st->lookahead_hits, st->lookahead_renders,
+            st->render_ns / 1e6, st->composite_ns / 1e6, st->blend_ns / 1e6, st->peak_scratch,
+            st->name, st->libass_same, st->libass_moved, st->libass_new,
+            st->shaper == ASS_SHAPING_SIMPLE ? "simple" : "complex", st->glyph_cache, st->bitmap_cache);
+    mutex_unlock(&stats_lock);
+}
+
+void VS_CC stats_vs(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi)
+{
+    // one array element per live instance, oldest first
+    mutex_lock(&stats_lock);
+
+    int count = 0;
+    for (render_stats* st = stats_list; st; st = st->next)
+        count++;
+
+    for (int i = count - 1; i >= 0; i--) {
+        render_stats* st = stats_list;
+        for (int k = 0; k < i; k++)
+            st = st->next;
+
+        vsapi->propSetInt(out, "id", st->id, paAppend);
+        vsapi->propSetData(out, "name", st->name, -1, paAppend);
+        vsapi->propSetInt(out, "frames", st->frames, paAppend);
+        vsapi->propSetInt(out, "frames_rendered", st->frames_rendered, paAppend);
+        vsapi->propSetInt(out, "frames_passed", st->frames_passed, paAppend);
+        vsapi->propSetInt(out, "cache_hits", st->cache_hits, paAppend);
+        vsapi->propSetInt(out, "lookahead_hits", st->lookahead_hits, paAppend);
+        vsapi->propSetInt(out, "lookahead_renders", st->lookahead_renders, paAppend);
+        vsapi->propSetInt(out, "libass_same", st->libass_same, paAppend);
+        vsapi->propSetInt(out, "libass_moved", st->libass_moved, paAppend);
+        vsapi->propSetInt(out, "libass_new", st->libass_new, paAppend);
+        vsapi->propSetInt(out, "render_ns", st->render_ns, paAppend);
+        vsapi->propSetInt(out, "composite_ns", st->composite_ns, paAppend);
+        vsapi->propSetInt(out, "blend_ns", st->blend_ns, paAppend);
+        vsapi->propSetInt(out, "peak_scratch", st->peak_scratch, paAppend);
+        vsapi->propSetInt(out, "glyph_cache", st->glyph_cache, paAppend);
+        vsapi->propSetInt(out, "bitmap_cache", st->bitmap_cache, paAppend);
+        vsapi->propSetData(out, "shaper", st->shaper == ASS_SHAPING_SIMPLE ? "simple" : "complex", -1, paAppend);
+    }
+
+    mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,41 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "assrender.h"
+
+// monotonic clock in nanoseconds, only differences are meaningful
+int64_t monotonic_ns(void);
+
+// cumulative counters of one filter instance, kept in a process-wide list
+// so Stats() can report every live instance
+typedef struct render_stats {
+    int id;
+    char* name;
+    int64_t frames;
+    int64_t frames_rendered;    // ass_render_frame or the glyph cache ran
+    int64_t frames_passed;      // nothing to draw, source frame returned
+    int64_t cache_hits;         // overlay reused from the previous frame
+    int64_t lookahead_hits;     // overlay rendered ahead by the worker
+    int64_t lookahead_renders;  // renders the worker did, used or not
+    // what ass_render_frame said: same images, only moved, new images.
+    // libass keeps no hit/miss counts of its own caches, this is the
+    // closest it tells
+    int64_t libass_same, libass_moved, libass_new;
+    int64_t render_ns, composite_ns, blend_ns;
+    int64_t peak_scratch;       // bytes of sub_img in use, at most
+    int glyph_cache, bitmap_cache;  // libass cache limits, 0 is its default
+    int shaper;                     // ASS_SHAPING_SIMPLE or _COMPLEX
+    struct render_stats* next;
+} render_stats;
+
+render_stats* stats_register(const char* name);
+void stats_unregister(render_stats* st);
+
+// adds one frame's delta, peak_scratch is maxed instead
+void stats_add(render_stats* st, const render_stats* frame);
+
+void stats_print(const render_stats* st);
+
+void VS_CC stats_vs(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi);
+
+#endif
@@ -1,80 +1,1018 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
 #include "sub.h"
 
-void ass_read_matrix(FILE* fh, char* csp) {
-    if (!fh)
-        return;
+static int read_header_value(const char* line, size_t len, const char* key, char* value)
+{
+    size_t keylen = strlen(key);
+    size_t n = 0;
+
+    if (len < keylen || strncmp(line, key, keylen))
+        return 0;
+
+    line += keylen;
+    len -= keylen;
+
+    while (len && isspace((unsigned char)*line))
+        line++, len--;
+
+    while (n < len && n < BUFSIZ - 1 && !isspace((unsigned char)line[n])) {
+        value[n] = line[n];
+        n++;
+    }
+
+    if (!n)
+        return 0;
+
+    value[n] = 0;
+    return 1;
+}
+
+const char* detect_bom(const char* buf, const size_t bufsize) {
+    if (bufsize >= 4) {
+        if (!strncmp(buf, "\xef\xbb\xbf", 3))
+            return "UTF-8";
+        if (!strncmp(buf, "\x00\x00\xfe\xff", 4))
+            return "UTF-32BE";
+        if (!strncmp(buf, "\xff\xfe\x00\x00", 4))
+            return "UTF-32LE";
+        if (!strncmp(buf, "\xfe\xff", 2))
+            return "UTF-16BE";
+        if (!strncmp(buf, "\xff\xfe", 2))
+            return "UTF-16LE";
+    }
+    return "UTF-8";
+}
+
+int ass_read_matrix(const char* buf, size_t size, char* csp)
+{
+    const char* p = buf;
+    const char* end = buf + size;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        size_t len;
+
+        if (!eol)
+            eol = end;
+
+        len = eol - p;
+        while (len && p[len - 1] == '\r')
+            len--;
+
+        if (len) {
+            if (read_header_value(p, len, "YCbCr Matrix:", csp))
+                return 1;
+
+            if (read_header_value(p, len, "Video Colorspace:", csp))
+                return 1;
+
+            // script info comes before the events, no need to look further
+            if (len == 8 && !strncmp(p, "[Events]", 8))
+                return 1;
+        }
+
+        p = eol + 1;
+    }
+
+    return 0;
+}
+
+static size_t last_line_end(const char* buf, size_t len)
+{
+    while (len && buf[len - 1] != '\n')
+        len--;
+
+    return len;
+}
+
+ASS_Track* ass_read_stream(ASS_Library* library, sub_stream* s, const char* cs, char* csp)
+{
+    size_t cap = ASS_STREAM_CHUNK;
+    size_t len = 0;
+    int eof = 0, matrix_done = 0;
+    char* buf = malloc(cap);
+    ASS_Track* track = NULL;
+
+    if (!buf)
+        return NULL;
+
+    len = stream_read(s, buf, cap);
+    if (cs == NULL)
+        cs = detect_bom(buf, len);
+
+    if (strcasecmp(cs, "UTF-8")) {
+        // iconv needs to see the whole script, collect it first
+        size_t n;
+
+        do {
+            if (len == cap) {
+                char* tmp = realloc(buf, cap *= 2);
+                if (!tmp) {
+                    free(buf);
+                    return NULL;
+                }
+                buf = tmp;
+            }
+            n = stream_read(s, buf + len, cap - len);
+            len += n;
+        } while (n);
+
+        if (!stream_error(s)) {
+            track = ass_read_memory(library, buf, len, (char*)cs);
+            ass_read_matrix(buf, len, csp);
+        }
+
+        free(buf);
+        return track;
+    }
+
+    track = ass_new_track(library);
+    if (!track) {
+        free(buf);
+        return NULL;
+    }
+
+    // feed the parser whole lines as they come out of the decoder
+    while (len || !eof) {
+        size_t used = eof ? len : last_line_end(buf, len);
+
+        if (used) {
+            if (!matrix_done)
+                matrix_done = ass_read_matrix(buf, used, csp);
+
+            ass_process_data(track, buf, (int)used);
+            memmove(buf, buf + used, len - used);
+            len -= used;
+        }
+
+        if (!eof) {
+            size_t n;
+
+            if (len == cap) {
+                // a single line longer than the buffer
+                char* tmp = realloc(buf, cap *= 2);
+                if (!tmp) {
+                    free(buf);
+                    ass_free_track(track);
+                    return NULL;
+                }
+                buf = tmp;
+            }
+
+            n = stream_read(s, buf + len, cap - len);
+            if (!n)
+                eof = 1;
+            len += n;
+        }
+    }
+
+    free(buf);
+
+    if (stream_error(s) || track->track_type == TRACK_TYPE_UNKNOWN) {
+        ass_free_track(track);
+        return NULL;
+    }
+
+    // external scripts don't have ReadOrder, same as ass_read_memory does
+    for (int i = 0; i < track->n_events; ++i)
+        track->events[i].ReadOrder = i;
+
+    ass_process_force_style(track);
+
+    return track;
+}
+
+static const char* next_line(const char* p, const char* end)
+{
+    const char* eol = memchr(p, '\n', end - p);
+
+    return eol ? eol + 1 : end;
+}
+
+static int line_starts(const char* p, const char* end, const char* s)
+{
+    size_t len = strlen(s);
+
+    return (size_t)(end - p) >= len && !strncasecmp(p, s, len);
+}
+
+// the event lines of the [Events] section, from after its Format line up to
+// the next section; 0 if parsing them apart could change the result
+static int find_events(const char* buf, size_t size, size_t* start, size_t* end)
+{
+    const char* p = buf;
+    const char* e = buf + size;
+    int in_events = 0, dialogue = 0;
+
+    *start = *end = 0;
+
+    while (p < e) {
+        const char* next = next_line(p, e);
+
+        if (*p == '[') {
+            if (in_events) {
+                in_events = 0;
+                *end = p - buf;
+            }
+
+            if (line_starts(p, next, "[Events]")) {
+                if (*start)
+                    return 0;
+                in_events = 1;
+                *start = next - buf;
+            }
+            // styles after the events would only apply to the last piece
+            else if (*start && line_starts(p, next, "[V4"))
+                return 0;
+        }
+        else if (in_events) {
+            // events before the Format line are read with the default one
+            if (line_starts(p, next, "Format:")) {
+                if (dialogue)
+                    return 0;
+                *start = next - buf;
+            }
+            else if (line_starts(p, next, "Dialogue:"))
+                dialogue = 1;
+        }
+
+        p = next;
+    }
+
+    if (in_events)
+        *end = size;
+
+    return *start && *end > *start;
+}
+
+// the header for every piece but the first, without fonts and graphics
+static char* copy_header(const char* buf, size_t size, size_t* len)
+{
+    const char* p = buf;
+    const char* end = buf + size;
+    char* header = malloc(size ? size : 1);
+    int skip = 0;
+
+    *len = 0;
+    if (!header)
+        return NULL;
+
+    while (p < end) {
+        const char* next = next_line(p, end);
+
+        if (*p == '[')
+            skip = line_starts(p, next, "[Fonts]") || line_starts(p, next, "[Graphics]");
+
+        if (!skip) {
+            memcpy(header + *len, p, next - p);
+            *len += next - p;
+        }
+
+        p = next;
+    }
+
+    return header;
+}
+
+typedef struct {
+    ASS_Library* library;
+    const char* part[3];
+    size_t len[3];
+    ASS_Track* track;
+} parse_job;
+
+static void* parse_piece(void* arg)
+{
+    parse_job* job = arg;
+    size_t size = job->len[0] + job->len[1] + job->len[2];
+    char* buf = malloc(size ? size : 1);
+    char* p = buf;
+
+    if (!buf)
+        return NULL;
+
+    for (int i = 0; i < 3; i++) {
+        if (job->len[i])
+            memcpy(p, job->part[i], job->len[i]);
+        p += job->len[i];
+    }
+
+    job->track = ass_read_memory(job->library, buf, size, NULL);
+    free(buf);
+
+    return NULL;
+}
+
+// moves the events of the other pieces to the first one, in file order
+static int merge_pieces(parse_job* jobs, int pieces)
+{
+    ASS_Track* track = jobs[0].track;
+    int total = 0;
+
+    for (int i = 0; i < pieces; i++) {
+        // every piece must have read the same styles for the indices to match
+        if (!jobs[i].track || jobs[i].track->n_styles != track->n_styles)
+            return 0;
+        if (jobs[i].track->n_events > INT_MAX - total)
+            return 0;
+        total += jobs[i].track->n_events;
+    }
+
+    if (total > track->max_events) {
+        ASS_Event* events = realloc(track->events, total * sizeof(ASS_Event));
+
+        if (!events)
+            return 0;
+        track->events = events;
+        track->max_events = total;
+    }
+
+    for (int i = 1; i < pieces; i++) {
+        ASS_Track* t = jobs[i].track;
+
+        for (int j = 0; j < t->n_events; j++) {
+            int eid = ass_alloc_event(track);
+
+            if (eid < 0)
+                return 0;
+
+            track->events[eid] = t->events[j];
+            track->events[eid].ReadOrder = eid;
+            // the text now belongs to the merged track
+            memset(t->events + j, 0, sizeof(ASS_Event));
+        }
+    }
+
+    return 1;
+}
+
+ASS_Track* ass_read_split(ASS_Library* library, const char* buf, size_t size, const char* cs, int pieces)
+{
+    size_t start, end, header_len;
+
+    if (cs || !find_events(buf, size, &start, &end))
+        return ass_read_memory(library, (char*)buf, size, (char*)cs);
+
+    if (!pieces) {
+        pieces = (int)((end - start) / ASS_PARSE_CHUNK);
+        if (pieces > cpu_count())
+            pieces = cpu_count();
+    }
+    if (pieces < 2)
+        return ass_read_memory(library, (char*)buf, size, (char*)cs);
+
+    char* header = copy_header(buf, start, &header_len);
+    parse_job* jobs = calloc(pieces, sizeof(parse_job));
+    thread* pool = calloc(pieces, sizeof(thread));
+    int* started = calloc(pieces, sizeof(int));
+    ASS_Track* track = NULL;
+
+    if (header && jobs && pool && started) {
+        size_t from = start;
+
+        for (int i = 0; i < pieces; i++) {
+            size_t to = i == pieces - 1 ? end : start + (end - start) / pieces * (i + 1);
+
+            // cut after a newline, a piece can come out empty
+            if (to < from)
+                to = from;
+            else if (to < end)
+                to = next_line(buf + to, buf + end) - buf;
+
+            jobs[i].library = library;
+            jobs[i].part[1] = buf + from;
+            jobs[i].len[1] = to - from;
+            from = to;
+        }
+
+        // the first piece keeps the full header and whatever follows the events
+        jobs[0].part[0] = buf;
+        jobs[0].len[0] = start;
+        jobs[0].part[2] = buf + end;
+        jobs[0].len[2] = size - end;
+        for (int i = 1; i < pieces; i++) {
+            jobs[i].part[0] = header;
+            jobs[i].len[0] = header_len;
+        }
+
+        for (int i = 1; i < pieces; i++)
+            started[i] = !thread_create(pool + i, parse_piece, jobs + i);
+        parse_piece(jobs);
+        for (int i = 1; i < pieces; i++) {
+            if (started[i])
+                thread_join(pool[i]);
+            else
+                parse_piece(jobs + i);
+        }
+
+        if (merge_pieces(jobs, pieces)) {
+            track = jobs[0].track;
+            jobs[0].track = NULL;
+        }
+
+        for (int i = 0; i < pieces; i++)
+            if (jobs[i].track)
+                ass_free_track(jobs[i].track);
+    }
+
+    free(started);
+    free(pool);
+    free(jobs);
+    free(header);
+
+    // whatever went wrong, libass gets to report it on its own
+    return track ? track : ass_read_memory(library, (char*)buf, size, (char*)cs);
+}
+
+ASS_Track* ass_read_parallel(ASS_Library* library, const char* buf, size_t size, const char* cs)
+{
+    return ass_read_split(library, buf, size, cs, 0);
+}
+
+ASS_Track* read_ass_file(ASS_Library* library, const char* filename, const char* cs, char* csp, const char** error)
+{
+    sub_stream* fs = stream_open(filename);
+    ASS_Track* track = NULL;
+
+    *error = NULL;
+
+    if (!fs || stream_error(fs)) {
+        *error = fs ? stream_error(fs) : "out of memory";
+        stream_close(fs);
+        return NULL;
+    }
+
+    if (stream_compressed(fs)) {
+        track = ass_read_stream(library, fs, cs, csp);
+    }
+    else {
+        mapped_file mf;
+
+        if (!map_file(filename, &mf)) {
+            *error = "could not map file";
+            stream_close(fs);
+            return NULL;
+        }
+        if (cs == NULL) {
+            cs = detect_bom(mf.data, mf.size);
+            // plain UTF-8 needs no recoding, let libass take the bytes as they are
+            if (!strcmp(cs, "UTF-8"))
+                cs = NULL;
+        }
+        track = ass_read_parallel(library, mf.data, mf.size, cs);
+        ass_read_matrix(mf.data, mf.size, csp);
+        unmap_file(&mf);
+    }
+
+    if (stream_error(fs)) {
+        *error = stream_error(fs);
+        if (track)
+            ass_free_track(track);
+        track = NULL;
+    }
+
+    stream_close(fs);
+
+    return track;
+}
+
+typedef struct {
+    char* buf;
+    size_t len, cap;
+} srt_text;
+
+static int text_append(srt_text* t, const char* s, size_t len)
+{
+    if (t->len + len + 1 > t->cap) {
+        size_t cap = t->cap ? t->cap : 256;
+        char* tmp;
+
+        while (t->len + len + 1 > cap)
+            cap *= 2;
+
+        tmp = realloc(t->buf, cap);
+        if (!tmp)
+            return 0;
+
+        t->buf = tmp;
+        t->cap = cap;
+    }
 
-    char buf[BUFSIZ];
+    memcpy(t->buf + t->len, s, len);
+    t->len += len;
+    t->buf[t->len] = 0;
 
-    while (fgets(buf, BUFSIZ - 1, fh) != NULL) {
-        if (buf[0] == 0 || buf[0] == '\n' || buf[0] == '\r')
+    return 1;
+}
+
+#define SRT_FONT_DEPTH 16
+
+// ASS values set by the currently open <font> tags
+typedef struct {
+    char color[16];
+    char face[64];
+    char size[16];
+} srt_font_tag;
+
+typedef struct {
+    srt_font_tag font[SRT_FONT_DEPTH];
+    int depth;
+} srt_markup;
+
+static const struct {
+    const char* name;
+    const char* rgb;
+} srt_colors[] = {
+    { "white", "FFFFFF" }, { "black", "000000" }, { "red", "FF0000" },
+    { "lime", "00FF00" }, { "green", "008000" }, { "blue", "0000FF" },
+    { "yellow", "FFFF00" }, { "cyan", "00FFFF" }, { "aqua", "00FFFF" },
+    { "magenta", "FF00FF" }, { "fuchsia", "FF00FF" }, { "silver", "C0C0C0" },
+    { "gray", "808080" }, { "grey", "808080" }, { "maroon", "800000" },
+    { "olive", "808000" }, { "navy", "000080" }, { "purple", "800080" },
+    { "teal", "008080" }, { "orange", "FFA500" },
+};
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '-' || c == '_';
+}
+
+// "#RRGGBB", "RRGGBB" or an HTML color name to &HBBGGRR&
+static int srt_color(const char* v, size_t len, char* out, size_t size)
+{
+    char rgb[7];
+
+    if (len && *v == '#')
+        v++, len--;
+
+    if (len == 6) {
+        size_t i;
+        for (i = 0; i < 6 && isxdigit((unsigned char)v[i]); i++)
+            rgb[i] = v[i];
+        if (i == 6) {
+            snprintf(out, size, "&H%.2s%.2s%.2s&", rgb + 4, rgb + 2, rgb);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(srt_colors) / sizeof(srt_colors[0]); i++) {
+        const char* rgbname = srt_colors[i].rgb;
+        if (strlen(srt_colors[i].name) == len && !strncasecmp(v, srt_colors[i].name, len)) {
+            snprintf(out, size, "&H%.2s%.2s%.2s&", rgbname + 4, rgbname + 2, rgbname);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void srt_font_attrs(const char* p, const char* end, srt_font_tag* f)
+{
+    memset(f, 0, sizeof(*f));
+
+    while (p < end) {
+        const char *name, *value;
+        size_t name_len, value_len;
+
+        while (p < end && !is_name_char(*p))
+            p++;
+        name = p;
+        while (p < end && is_name_char(*p))
+            p++;
+        name_len = p - name;
+
+        while (p < end && isspace((unsigned char)*p))
+            p++;
+        if (p == end || *p != '=')
             continue;
+        p++;
+        while (p < end && isspace((unsigned char)*p))
+            p++;
+
+        if (p < end && (*p == '"' || *p == '\'')) {
+            char q = *p++;
+            value = p;
+            while (p < end && *p != q)
+                p++;
+            value_len = p - value;
+            if (p < end)
+                p++;
+        }
+        else {
+            value = p;
+            while (p < end && !isspace((unsigned char)*p))
+                p++;
+            value_len = p - value;
+        }
+
+        if (name_len == 5 && !strncasecmp(name, "color", 5)) {
+            srt_color(value, value_len, f->color, sizeof(f->color));
+        }
+        else if (name_len == 4 && !strncasecmp(name, "face", 4) && value_len && value_len < sizeof(f->face)) {
+            memcpy(f->face, value, value_len);
+            f->face[value_len] = 0;
+        }
+        else if (name_len == 4 && !strncasecmp(name, "size", 4) && value_len && value_len < sizeof(f->size)) {
+            size_t i;
+            for (i = 0; i < value_len && (isdigit((unsigned char)value[i]) || value[i] == '.'); i++)
+                f->size[i] = value[i];
+            f->size[i] = 0;
+        }
+    }
+}
 
-        if (sscanf(buf, "YCbCr Matrix: %s", csp) == 1)
+static int append_str(srt_text* t, const char* s)
+{
+    return text_append(t, s, strlen(s));
+}
+
+// emits the override for one <font> attribute when a tag closes: the value
+// of the nearest enclosing tag that set it, or a reset to the style
+static int srt_restore(srt_text* t, srt_markup* m, size_t offset, const char* tag)
+{
+    const char* value = "";
+
+    for (int i = m->depth - 1; i >= 0; i--) {
+        const char* v = (const char*)&m->font[i] + offset;
+        if (*v) {
+            value = v;
             break;
+        }
+    }
 
-        if (sscanf(buf, "Video Colorspace: %s", csp) == 1)
-          break;
+    return append_str(t, tag) && append_str(t, value);
+}
+
+// returns the number of bytes consumed, 0 when p doesn't start a known tag
+static size_t srt_tag(srt_text* t, srt_markup* m, const char* p, const char* end, int* ok)
+{
+    const char* gt = memchr(p, '>', end - p);
+    const char *q = p + 1, *name;
+    size_t name_len;
+    int closing = 0;
+
+    if (!gt)
+        return 0;
 
-        if (!strcmp(buf, "[Events]"))
+    while (q < gt && isspace((unsigned char)*q))
+        q++;
+    if (q < gt && *q == '/')
+        closing = 1, q++;
+    name = q;
+    while (q < gt && isalpha((unsigned char)*q))
+        q++;
+    name_len = q - name;
+
+    if (q < gt && !isspace((unsigned char)*q) && *q != '/')
+        return 0;
+
+    if (name_len == 1 && strchr("ibusIBUS", *name)) {
+        char tag[8];
+        snprintf(tag, sizeof(tag), "{\\%c%d}", tolower((unsigned char)*name), !closing);
+        *ok = append_str(t, tag);
+    }
+    else if (name_len == 4 && !strncasecmp(name, "font", 4)) {
+        if (closing) {
+            srt_font_tag f;
+
+            if (!m->depth)
+                return gt + 1 - p;
+
+            f = m->font[--m->depth];
+            *ok = append_str(t, "{");
+            if (*ok && *f.color)
+                *ok = srt_restore(t, m, offsetof(srt_font_tag, color), "\\c");
+            if (*ok && *f.face)
+                *ok = srt_restore(t, m, offsetof(srt_font_tag, face), "\\fn");
+            if (*ok && *f.size)
+                *ok = srt_restore(t, m, offsetof(srt_font_tag, size), "\\fs");
+            *ok = *ok && append_str(t, "}");
+        }
+        else {
+            srt_font_tag f;
+
+            srt_font_attrs(q, gt, &f);
+            if (m->depth < SRT_FONT_DEPTH)
+                m->font[m->depth++] = f;
+
+            *ok = append_str(t, "{");
+            if (*ok && *f.color)
+                *ok = append_str(t, "\\c") && append_str(t, f.color);
+            if (*ok && *f.face)
+                *ok = append_str(t, "\\fn") && append_str(t, f.face);
+            if (*ok && *f.size)
+                *ok = append_str(t, "\\fs") && append_str(t, f.size);
+            *ok = *ok && append_str(t, "}");
+        }
+    }
+    else {
+        return 0;
+    }
+
+    return gt + 1 - p;
+}
+
+// copies one SRT line, turning <i> <b> <u> <s> and <font> into ASS overrides
+static int srt_append_line(srt_text* t, srt_markup* m, const char* p, const char* end)
+{
+    while (p < end) {
+        const char* lt = memchr(p, '<', end - p);
+        size_t used;
+        int ok = 1;
+
+        if (!lt)
             break;
+
+        if (!text_append(t, p, lt - p))
+            return 0;
+
+        used = srt_tag(t, m, lt, end, &ok);
+        if (!ok)
+            return 0;
+
+        // not markup we know, keep the bracket as text
+        if (!used) {
+            if (!text_append(t, "<", 1))
+                return 0;
+            used = 1;
+        }
+
+        p = lt + used;
     }
 
-    fclose(fh);
+    return text_append(t, p, end - p);
+}
+
+static const char* srt_number(const char* p, const char* end, int* v)
+{
+    int n = 0, digits = 0;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    while (p < end && *p >= '0' && *p <= '9' && digits < 9) {
+        n = n * 10 + (*p++ - '0');
+        digits++;
+    }
+
+    *v = n;
+    return digits ? p : NULL;
+}
+
+// h:m:s,ms -- a dot is accepted in place of the comma as well
+static const char* srt_time(const char* p, const char* end, long long* ms)
+{
+    int h, m, sec, f;
+
+    if (!(p = srt_number(p, end, &h)) || p == end || *p++ != ':')
+        return NULL;
+    if (!(p = srt_number(p, end, &m)) || p == end || *p++ != ':')
+        return NULL;
+    if (!(p = srt_number(p, end, &sec)) || p == end || (*p != ',' && *p != '.'))
+        return NULL;
+    if (!(p = srt_number(p + 1, end, &f)))
+        return NULL;
+
+    *ms = ((h * 60LL + m) * 60 + sec) * 1000 + f;
+    return p;
 }
 
-ASS_Track* parse_srt(FILE* fh, udata* ud, const char* srt_font)
+static int srt_timing(const char* p, const char* end, long long* start, long long* stop)
+{
+    if (!(p = srt_time(p, end, start)))
+        return 0;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    if (end - p < 3 || strncmp(p, "-->", 3))
+        return 0;
+
+    return srt_time(p + 3, end, stop) != NULL;
+}
+
+static int find_style(ASS_Track* track, const char* name)
+{
+    // same lookup order as libass, the last definition wins
+    for (int i = track->n_styles - 1; i >= 0; i--)
+        if (!strcmp(track->styles[i].Name, name))
+            return i;
+
+    return track->default_style;
+}
+
+static int add_srt_event(ASS_Track* track, int style, long long start, long long stop, srt_text* text)
+{
+    int eid = ass_alloc_event(track);
+    ASS_Event* event;
+
+    if (eid < 0)
+        return 0;
+
+    event = track->events + eid;
+    event->Start = start;
+    event->Duration = stop - start;
+    event->ReadOrder = eid;
+    event->Layer = 0;
+    event->Style = style;
+    event->Name = strdup("");
+    event->Effect = strdup("");
+    event->Text = text->buf;
+
+    text->buf = NULL;
+    text->len = text->cap = 0;
+
+    return 1;
+}
+
+ASS_Track* parse_srt(sub_stream* fh, udata* ud, const char* srt_font, const char* srt_style, double srt_blur)
 {
     if (!fh)
         return NULL;
 
-    char l[BUFSIZ], buf[BUFSIZ];
-    int start[4], end[4], isn;
+    char header[BUFSIZ], prefix[32] = "";
+    size_t cap = ASS_STREAM_CHUNK, len = 0, prefix_len;
+    int eof = 0, in_event = 0, lines = 0, style;
+    long long start = 0, stop = 0;
+    srt_text text = { 0 };
+    srt_markup markup;
+    char* buf;
     ASS_Track* ass = ass_new_track(ud->ass_library);
 
-    sprintf(buf, "[V4+ Styles]\nStyle: Default,%s,20,&H1EFFFFFF,&H00FFFFFF,"
-            "&H29000000,&H3C000000,0,0,0,0,100,100,0,0,1,1,1.2,2,10,10,"
-            "12,1\n\n[Events]\n",
-            srt_font);
+    if (!ass)
+        return NULL;
 
-    ass_process_data(ass, buf, BUFSIZ - 1);
+    markup.depth = 0;
 
-    while (fgets(l, BUFSIZ - 1, fh) != NULL) {
-        if (l[0] == 0 || l[0] == '\n' || l[0] == '\r')
-            continue;
+    if (srt_style)
+        snprintf(header, sizeof(header), "[V4+ Styles]\nStyle: Default,%s\n\n[Events]\n", srt_style);
+    else
+        snprintf(header, sizeof(header),
+                 "[V4+ Styles]\nStyle: Default,%s,20,&H1EFFFFFF,&H00FFFFFF,"
+                 "&H29000000,&H3C000000,0,0,0,0,100,100,0,0,1,1,1.2,2,10,10,"
+                 "12,1\n\n[Events]\n",
+                 srt_font);
 
-        if (sscanf(l, "%d:%d:%d,%d --> %d:%d:%d,%d", &start[0], &start[1],
-                   &start[2], &start[3], &end[0], &end[1], &end[2],
-                   &end[3]) == 8) {
-            sprintf(buf, "Dialogue: 0,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,"
-                    "Default,,0,0,0,,{\\blur0.7}",
-                    start[0], start[1], start[2],
-                    (int)((double)start[3] / 10.0 + 0.5), end[0], end[1],
-                    end[2], (int)((double)end[3] / 10.0 + 0.5));
-            isn = 0;
-
-            while (fgets(l, BUFSIZ - 1, fh) != NULL) {
-                if (l[0] == 0 || l[0] == '\n' || l[0] == '\r')
-                    break;
-
-                if (l[strlen(l) - 1] == '\n' || l[strlen(l) - 1] == '\r')
-                    l[strlen(l) - 1] = 0;
-
-                if (isn) {
-                    strcat(buf, "\\N");
+    ass_process_data(ass, header, (int)strlen(header));
+    style = find_style(ass, "Default");
+
+    // no blur at all keeps libass on its cheaper unblurred path;
+    // fixed point so the host locale can't turn the dot into a comma
+    if (srt_blur > 0) {
+        int blur = (int)(srt_blur * 1000 + 0.5);
+        snprintf(prefix, sizeof(prefix), "{\\blur%d.%03d}", blur / 1000, blur % 1000);
+    }
+    prefix_len = strlen(prefix);
+
+    buf = malloc(cap);
+    if (!buf) {
+        ass_free_track(ass);
+        return NULL;
+    }
+
+    // one pass over the stream, cues go straight into the track
+    while (len || !eof) {
+        const char* p = buf;
+        const char* end = buf + (eof ? len : last_line_end(buf, len));
+
+        while (p < end) {
+            const char* eol = memchr(p, '\n', end - p);
+            const char* next;
+
+            if (!eol)
+                eol = end;
+            next = eol < end ? eol + 1 : end;
+
+            while (eol > p && (eol[-1] == '\r' || eol[-1] == '\n'))
+                eol--;
+
+            if (in_event) {
+                if (eol == p) {
+                    if (!add_srt_event(ass, style, start, stop, &text))
+                        goto fail;
+                    in_event = 0;
+                }
+                else if ((lines++ && !text_append(&text, "\\N", 2)) ||
+                         !srt_append_line(&text, &markup, p, eol)) {
+                    goto fail;
                 }
+            }
+            else if (eol > p && srt_timing(p, eol, &start, &stop)) {
+                if (!text_append(&text, prefix, prefix_len))
+                    goto fail;
+                in_event = 1;
+                lines = 0;
+                markup.depth = 0;
+            }
+
+            p = next;
+        }
+
+        memmove(buf, end, len - (end - buf));
+        len -= end - buf;
 
-                strncat(buf, l, BUFSIZ - 1);
-                isn = 1;
+        if (!eof) {
+            size_t n;
+
+            if (len == cap) {
+                char* tmp = realloc(buf, cap *= 2);
+                if (!tmp)
+                    goto fail;
+                buf = tmp;
             }
 
-            ass_process_data(ass, buf, BUFSIZ - 1);
+            n = stream_read(fh, buf + len, cap - len);
+            if (!n)
+                eof = 1;
+            len += n;
         }
     }
 
-    fclose(fh);
+    if (in_event && !add_srt_event(ass, style, start, stop, &text))
+        goto fail;
+
+    free(text.buf);
+    free(buf);
 
     return ass;
+
+fail:
+    free(text.buf);
+    free(buf);
+    ass_free_track(ass);
+
+    return NULL;
+}
+
+ASS_Track* new_subtitle_track(ASS_Library* library, int width, int height, const char* style)
+{
+    char header[BUFSIZ];
+    ASS_Track* track = ass_new_track(library);
+
+    if (!track)
+        return NULL;
+
+    snprintf(header, sizeof(header),
+             "[Script Info]\n"
+             "ScriptType: v4.00+\n"
+             "PlayResX: %d\n"
+             "PlayResY: %d\n"
+             "[V4+ Styles]\n"
+             "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n"
+             "Style: Default,%s\n"
+             "[Events]\n"
+             "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n",
+             width, height, style);
+
+    ass_process_data(track, header, (int)strlen(header));
+
+    return track;
+}
+
+int add_subtitle_event(ASS_Track* track, long long start, long long stop, const char* text)
+{
+    size_t len = 0, breaks = 0;
+    char* out;
+    int eid;
+    ASS_Event* event;
+
+    for (const char* p = text; *p; p++, len++)
+        breaks += *p == '\n';
+
+    // newlines become \N, everything else is taken as is
+    out = malloc(len + breaks + 1);
+    if (!out)
+        return 0;
+
+    for (char* q = out; ; text++) {
+        if (*text == '\n') {
+            *q++ = '\\';
+            *q++ = 'N';
+        }
+        else if (!(*q++ = *text)) {
+            break;
+        }
+    }
+
+    eid = ass_alloc_event(track);
+    if (eid < 0) {
+        free(out);
+        return 0;
+    }
+
+    event = track->events + eid;
+    event->Start = start;
+    event->Duration = stop - start;
+    event->ReadOrder = eid;
+    event->Layer = 0;
+    event->Style = find_style(track, "Default");
+    event->Name = strdup("");
+    event->Effect = strdup("");
+    event->Text = out;
+
+    return 1;
 }
 
 void msg_callback(int level, const char* fmt, va_list va, void* data)
@@ -87,8 +1025,72 @@ void msg_callback(int level, const char* fmt, va_list va, void* data)
     fprintf(stderr, "\n");
 }
 
+// code points the simple shaper lays out like HarfBuzz does, ligatures aside
+static int simple_cp(uint32_t cp)
+{
+    return cp < 0x300                               // Latin, IPA, spacing modifiers
+        || (cp >= 0x370 && cp < 0x483)              // Greek, Cyrillic
+        || (cp >= 0x48A && cp < 0x530)              // Cyrillic
+        || (cp >= 0x1E00 && cp < 0x20D0 && cp != 0x200C && cp != 0x200D)  // Latin/Greek extended, punctuation, currency
+        || (cp >= 0x2100 && cp < 0x2C00);           // letterlike, arrows, maths, box drawing, dingbats
+}
+
+static int needs_complex_text(const char* text)
+{
+    const unsigned char* p = (const unsigned char*)text;
+
+    while (*p) {
+        if (*p == '{') {
+            // override tags, only a vertical font matters
+            while (*p && *p != '}') {
+                if (p[0] == '\\' && p[1] == 'f' && p[2] == 'n' && p[3] == '@')
+                    return 1;
+                p++;
+            }
+            continue;
+        }
+
+        uint32_t cp = *p++;
+        int extra = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+
+        if (extra) {
+            cp &= 0x3F >> extra;
+            while (extra-- && (*p & 0xC0) == 0x80)
+                cp = (cp << 6) | (*p++ & 0x3F);
+        }
+
+        if (!simple_cp(cp))
+            return 1;
+    }
+
+    return 0;
+}
+
+int needs_complex_shaper(const ASS_Track* track)
+{
+    if (track->Kerning)
+        return 1;
+
+    for (int i = 0; i < track->n_styles; i++)
+        if (track->styles[i].FontName && track->styles[i].FontName[0] == '@')
+            return 1;
+
+    for (int i = 0; i < track->n_events; i++)
+        if (track->events[i].Text && needs_complex_text(track->events[i].Text))
+            return 1;
+
+    return 0;
+}
+
+int auto_bitmap_cache(int width, int height)
+{
+    int64_t mb = ((int64_t)width * height * 64) >> 20;
+
+    return mb < 16 ? 16 : mb > 1024 ? 1024 : (int)mb;
+}
+
 int init_ass(int w, int h, double scale, double line_spacing, ASS_Hinting hinting,
-             int frame_width, int frame_height, double dar, double sar, int set_default_storage_size,
+             int glyph_cache, int bitmap_cache, int frame_width, int frame_height, double dar, double sar, int set_default_storage_size,
              int top, int bottom, int left, int right, int verbosity,
              const char* fontdir, udata* ud)
 {
@@ -104,11 +1106,15 @@ int init_ass(int w, int h, double scale, double line_spacing, ASS_Hinting hintin
 
     ass_renderer = ass_renderer_init(ass_library);
 
-    if (!ass_renderer)
+    if (!ass_renderer) {
+        ass_library_done(ass_library);
         return 0;
+    }
 
     ass_set_font_scale(ass_renderer, scale);
     ass_set_hinting(ass_renderer, hinting);
+    // libass derives the composite cache limit from the bitmap one
+    ass_set_cache_limits(ass_renderer, glyph_cache, bitmap_cache);
     ass_set_margins(ass_renderer, top, bottom, left, right);
     ass_set_use_margins(ass_renderer, 1);
 
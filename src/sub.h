@@ -3,13 +3,60 @@
 
 // #include <fontconfig/fontconfig.h>
 #include "assrender.h"
+#include "fileio.h"
 
-void ass_read_matrix(FILE* fh, char* csp);
+#define ASS_STREAM_CHUNK (1 << 20)
 
-ASS_Track* parse_srt(FILE* fh, udata* ud, const char* srt_font);
+const char* detect_bom(const char* buf, const size_t bufsize);
 
+// csp must hold BUFSIZ bytes, returns 1 once the header has been fully scanned
+int ass_read_matrix(const char* buf, size_t size, char* csp);
+
+// parses a script from a (possibly compressed) stream, UTF-8 input is
+// fed to libass line by line without holding the whole file in memory
+ASS_Track* ass_read_stream(ASS_Library* library, sub_stream* s, const char* cs, char* csp);
+
+// event lines per parser thread of ass_read_parallel
+#define ASS_PARSE_CHUNK (8 << 20)
+
+// ass_read_memory for big UTF-8 scripts: the [Events] section is split at
+// line boundaries and the pieces are parsed on up to one thread per core,
+// each under a copy of the header, then merged in file order. Recoded or
+// small scripts, and layouts it can't split safely, are parsed in one go.
+ASS_Track* ass_read_parallel(ASS_Library* library, const char* buf, size_t size, const char* cs);
+
+// the same split into this many pieces whatever the size of the script,
+// 0 picks the number as ass_read_parallel does
+ASS_Track* ass_read_split(ASS_Library* library, const char* buf, size_t size, const char* cs, int pieces);
+
+// an ASS or SSA file, plain or compressed; NULL with error set if it can't
+// be read, NULL alone if libass can't parse it
+ASS_Track* read_ass_file(ASS_Library* library, const char* filename, const char* cs, char* csp, const char** error);
+
+// srt_style replaces the built-in style fields (everything after the name),
+// srt_blur <= 0 leaves the \blur override out
+ASS_Track* parse_srt(sub_stream* fh, udata* ud, const char* srt_font, const char* srt_style, double srt_blur);
+
+// Subtitle(): the header goes through libass, events are added directly
+// with times in ms, newlines in text are turned into \N
+ASS_Track* new_subtitle_track(ASS_Library* library, int width, int height, const char* style);
+int add_subtitle_event(ASS_Track* track, long long start, long long stop, const char* text);
+
+// 1 if some text of the track needs the HarfBuzz shaper: anything outside
+// Latin, Greek, Cyrillic and common symbols, combining marks, joiners,
+// vertical (@) fonts, or Kerning: yes
+int needs_complex_shaper(const ASS_Track* track);
+
+// MiB of libass bitmap cache for rendering at this size: the libass default
+// of 128 MiB is about 64 frames of 1080p, keep that ratio within 16-1024
+int auto_bitmap_cache(int width, int height);
+
+// libass messages up to the verbosity passed as data go to stderr
+void msg_callback(int level, const char* fmt, va_list va, void* data);
+
+// glyph_cache and bitmap_cache (MiB) of 0 keep the libass defaults
 int init_ass(int w, int h, double scale, double line_spacing, ASS_Hinting hinting,
-             int frame_width, int frame_height, double dar, double sar, int set_default_storage_size,
+             int glyph_cache, int bitmap_cache, int frame_width, int frame_height, double dar, double sar, int set_default_storage_size,
              int top, int bottom, int left, int right, int verbosity,
              const char* fontdir, udata* ud);
 
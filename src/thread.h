@@ -0,0 +1,133 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#include <stdlib.h>
+#include <windows.h>
+
+typedef SRWLOCK mutex;
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#define MUTEX_INITIALIZER SRWLOCK_INIT
+#define mutex_init(m) InitializeSRWLock(m)
+#define mutex_destroy(m) ((void)(m))
+#define mutex_lock(m) AcquireSRWLockExclusive(m)
+#define mutex_unlock(m) ReleaseSRWLockExclusive(m)
+
+typedef CONDITION_VARIABLE cond;
+
+#define COND_INITIALIZER CONDITION_VARIABLE_INIT
+#define cond_init(c) InitializeConditionVariable(c)
+#define cond_destroy(c) ((void)(c))
+#define cond_wait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define cond_signal(c) WakeConditionVariable(c)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+
+// a counter threads can change without a lock
+typedef volatile LONG counter;
+
+#define counter_inc(c) InterlockedIncrement(c)
+#define counter_dec(c) InterlockedDecrement(c)
+#define counter_get(c) InterlockedCompareExchange(c, 0, 0)
+#define counter_set(c, v) InterlockedExchange(c, v)
+
+typedef HANDLE thread;
+typedef void* (*thread_func)(void* arg);
+
+typedef struct {
+    thread_func func;
+    void* arg;
+} thread_start;
+
+static inline DWORD WINAPI thread_trampoline(LPVOID param)
+{
+    thread_start start = *(thread_start*)param;
+
+    free(param);
+    start.func(start.arg);
+
+    return 0;
+}
+
+// returns 0 on success, like pthread_create
+static inline int thread_create(thread* t, thread_func func, void* arg)
+{
+    thread_start* start = malloc(sizeof(thread_start));
+
+    if (!start)
+        return -1;
+    start->func = func;
+    start->arg = arg;
+
+    *t = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (!*t) {
+        free(start);
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void thread_join(thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline int cpu_count(void)
+{
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t mutex;
+
+#define THREAD_LOCAL __thread
+
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define mutex_init(m) pthread_mutex_init(m, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+
+typedef pthread_cond_t cond;
+
+#define COND_INITIALIZER PTHREAD_COND_INITIALIZER
+#define cond_init(c) pthread_cond_init(c, NULL)
+#define cond_destroy(c) pthread_cond_destroy(c)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_signal(c) pthread_cond_signal(c)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+
+typedef int counter;
+
+#define counter_inc(c) __atomic_add_fetch(c, 1, __ATOMIC_SEQ_CST)
+#define counter_dec(c) __atomic_sub_fetch(c, 1, __ATOMIC_SEQ_CST)
+#define counter_get(c) __atomic_load_n(c, __ATOMIC_SEQ_CST)
+#define counter_set(c, v) __atomic_store_n(c, v, __ATOMIC_SEQ_CST)
+
+typedef pthread_t thread;
+typedef void* (*thread_func)(void* arg);
+
+#define thread_create(t, func, arg) pthread_create(t, NULL, func, arg)
+#define thread_join(t) pthread_join(t, NULL)
+
+static inline int cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+#endif
+
+#endif
@@ -1,77 +1,371 @@
 #include "timecodes.h"
 
-int parse_timecodesv1(FILE* f, int total, udata* ud)
+static int add_segment(timecodes* tc, int first, double step)
 {
-    int start, end, n = 0;
+    if (tc->nsegments % 16 == 0) {
+        tc_segment* tmp = realloc(tc->segments, (tc->nsegments + 16) * sizeof(tc_segment));
+        if (!tmp)
+            return 0;
+        tc->segments = tmp;
+    }
+
+    tc->segments[tc->nsegments].first = first;
+    tc->segments[tc->nsegments].step = step;
+    tc->nsegments++;
+
+    return 1;
+}
+
+// last segment starting at or before frame n
+static int find_segment(const timecodes* tc, int n)
+{
+    int lo = 0, hi = tc->nsegments - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (tc->segments[mid].first <= n)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+// Frame times are accumulated frame by frame exactly like the old per-frame
+// table was filled, so the rounding matches it bit for bit. The running sum
+// is kept every TC_CHECKPOINT frames and replayed from there on lookup.
+static double replay(const timecodes* tc, int from, double t, int to)
+{
+    int seg = find_segment(tc, from);
+    int next = seg + 1 < tc->nsegments ? tc->segments[seg + 1].first : INT_MAX;
+
+    for (int k = from; k < to; k++) {
+        while (k >= next) {
+            seg++;
+            next = seg + 1 < tc->nsegments ? tc->segments[seg + 1].first : INT_MAX;
+        }
+        t += tc->segments[seg].step;
+    }
+
+    return t;
+}
+
+int64_t timecodes_get(const timecodes* tc, int n)
+{
+    int c;
+
+    if (tc->timestamp)
+        return tc->timestamp[n];
+
+    c = n / TC_CHECKPOINT;
+    if (c >= tc->ncheckpoints)
+        c = tc->ncheckpoints - 1;
+
+    return (int64_t)(replay(tc, c * TC_CHECKPOINT, tc->checkpoints[c], n) + 0.5);
+}
+
+static void free_timecodes(timecodes* tc)
+{
+    if (!tc)
+        return;
+
+    free(tc->segments);
+    free(tc->checkpoints);
+    free(tc->timestamp);
+    free(tc);
+}
+
+static const char* next_line(const char* p, const char* end)
+{
+    const char* eol = memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+// "# timecode format vN", newer mkvtoolnix writes "# timestamp format vN"
+static int parse_header(const char** p, const char* end)
+{
+    char l[64];
+    const char* eol = next_line(*p, end);
+    size_t len = eol - *p;
+    int ver;
+
+    if (len >= sizeof(l))
+        len = sizeof(l) - 1;
+    memcpy(l, *p, len);
+    l[len] = 0;
+
+    if (sscanf(l, "# timecode format v%d", &ver) != 1 &&
+        sscanf(l, "# timestamp format v%d", &ver) != 1)
+        return 0;
+
+    *p = eol;
+    return ver;
+}
+
+static timecodes* parse_timecodesv1(const char* p, const char* end, int total)
+{
+    int start, stop, n = 0;
     double t = 0.0, basefps = 0.0, fps;
     char l[BUFSIZ];
-    int64_t* ts = calloc(total, sizeof(int64_t));
+    timecodes* tc = calloc(1, sizeof(timecodes));
 
-    if (!ts)
-        return 0;
+    if (!tc)
+        return NULL;
+
+    // same walk as filling a per-frame table, but only the ranges are kept
+    while (p < end && n < total) {
+        const char* eol = next_line(p, end);
+        size_t len = eol - p < BUFSIZ - 1 ? eol - p : BUFSIZ - 2;
+
+        memcpy(l, p, len);
+        l[len] = 0;
+        p = eol;
 
-    while ((fgets(l, BUFSIZ - 1, f) != NULL) && n < total) {
         if (l[0] == 0 || l[0] == '\n' || l[0] == '\r' || l[0] == '#')
             continue;
 
         if (sscanf(l, "Assume %lf", &basefps) == 1)
             continue;
 
-        if (!(sscanf(l, "%d,%d,%lf", &start, &end, &fps) == 3))
+        if (!(sscanf(l, "%d,%d,%lf", &start, &stop, &fps) == 3))
             continue;
 
         if (basefps == 0.0)
             continue;
 
-        while (n < start && n < total) {
-            ts[n++] = (int64_t)(t + 0.5);
-            t += 1000.0 / basefps;
+        if (n < start) {
+            if (!add_segment(tc, n, 1000.0 / basefps))
+                goto fail;
+            n = start < total ? start : total;
         }
 
-        while (n <= end && n < total) {
-            ts[n++] = (int64_t)(t + 0.5);
-            t += 1000.0 / fps;
+        if (n <= stop && n < total) {
+            if (!add_segment(tc, n, 1000.0 / fps))
+                goto fail;
+            n = stop < total - 1 ? stop + 1 : total;
         }
     }
 
-    if (basefps == 0.0) {
+    if (basefps == 0.0)
+        goto fail;
+
+    if (n < total && !add_segment(tc, n, 1000.0 / basefps))
+        goto fail;
+
+    tc->ncheckpoints = (total - 1) / TC_CHECKPOINT + 1;
+    tc->checkpoints = malloc(tc->ncheckpoints * sizeof(double));
+    if (!tc->checkpoints)
+        goto fail;
+
+    for (int c = 0; c < tc->ncheckpoints; c++) {
+        if (c)
+            t = replay(tc, (c - 1) * TC_CHECKPOINT, t, c * TC_CHECKPOINT);
+        tc->checkpoints[c] = t;
+    }
+
+    tc->count = total;
+
+    return tc;
+
+fail:
+    free_timecodes(tc);
+    return NULL;
+}
+
+static int cmp_int64(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// v2: integer milliseconds per line, truncated like atoll() always did
+// v4: same layout but fractional and not necessarily sorted, rounded
+static timecodes* parse_timecodesv2(const char* p, const char* end, int v4)
+{
+    size_t lines = 1, n = 0;
+    const char* q = p;
+    timecodes* tc;
+    int64_t* ts;
+
+    while ((q = memchr(q, '\n', end - q)) != NULL)
+        q++, lines++;
+
+    tc = calloc(1, sizeof(timecodes));
+    ts = malloc(lines * sizeof(int64_t));
+    if (!tc || !ts) {
+        free(tc);
         free(ts);
-        return 0;
+        return NULL;
     }
 
-    while (n < total) {
-        ts[n++] = (int64_t)(t + 0.5);
-        t += 1000.0 / basefps;
+    while (p < end) {
+        int64_t v = 0, frac = 0, scale = 1;
+        int neg = 0;
+
+        if (*p == '\n' || *p == '\r' || *p == '#' || *p == 0) {
+            p = next_line(p, end);
+            continue;
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\v' || *p == '\f'))
+            p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            neg = *p++ == '-';
+        while (p < end && (unsigned)(*p - '0') < 10)
+            v = v * 10 + (*p++ - '0');
+
+        if (v4 && p < end && *p == '.') {
+            p++;
+            while (p < end && (unsigned)(*p - '0') < 10) {
+                if (scale < 1000000000) {
+                    frac = frac * 10 + (*p - '0');
+                    scale *= 10;
+                }
+                p++;
+            }
+            v += (frac * 2 >= scale);
+        }
+
+        ts[n++] = neg ? -v : v;
+        p = next_line(p, end);
     }
 
-    ud->timestamp = ts;
+    if (v4)
+        qsort(ts, n, sizeof(int64_t), cmp_int64);
 
-    return 1;
+    tc->timestamp = n ? realloc(ts, n * sizeof(int64_t)) : ts;
+    if (!tc->timestamp)
+        tc->timestamp = ts;
+    tc->count = (int)(n > INT_MAX ? INT_MAX : n);
+
+    return tc;
 }
 
-int parse_timecodesv2(FILE* f, int total, udata* ud)
+// v2/v4 tables don't depend on the clip, instances using the same file share one
+typedef struct tc_entry {
+    char* path;
+    long long size, mtime;
+    timecodes* tc;
+    int refs;
+    struct tc_entry* next;
+} tc_entry;
+
+static tc_entry* tc_cache = NULL;
+static mutex tc_cache_lock = MUTEX_INITIALIZER;
+
+static timecodes* cache_find(const char* path, long long size, long long mtime)
 {
-    int n = 0;
-    int64_t* ts = calloc(total, sizeof(int64_t));
-    char l[BUFSIZ];
+    for (tc_entry* e = tc_cache; e; e = e->next) {
+        if (e->size == size && e->mtime == mtime && !strcmp(e->path, path)) {
+            e->refs++;
+            return e->tc;
+        }
+    }
 
-    if (!ts) {
-        return 0;
+    return NULL;
+}
+
+static void cache_add(const char* path, long long size, long long mtime, timecodes* tc)
+{
+    tc_entry* e = malloc(sizeof(tc_entry));
+
+    if (!e)
+        return;
+
+    e->path = strdup(path);
+    e->size = size;
+    e->mtime = mtime;
+    e->tc = tc;
+    e->refs = 1;
+    e->next = tc_cache;
+    tc_cache = e;
+}
+
+timecodes* open_timecodes(const char* filename, int total, const char** error)
+{
+    long long size = 0, mtime = 0;
+    int ver, have_stat = file_stat(filename, &size, &mtime);
+    timecodes* tc = NULL;
+    mapped_file mf;
+    const char *p, *end;
+
+    mutex_lock(&tc_cache_lock);
+
+    if (have_stat && (tc = cache_find(filename, size, mtime)) != NULL) {
+        mutex_unlock(&tc_cache_lock);
+        goto check;
     }
 
-    while ((fgets(l, BUFSIZ - 1, f) != NULL) && n < total) {
-        if (l[0] == 0 || l[0] == '\n' || l[0] == '\r' || l[0] == '#')
-            continue;
+    if (!have_stat || !map_file(filename, &mf)) {
+        mutex_unlock(&tc_cache_lock);
+        *error = "could not read timecodes file";
+        return NULL;
+    }
+
+    p = mf.data;
+    end = mf.data + mf.size;
 
-        ts[n++] = atoll(l);
+    switch (ver = parse_header(&p, end)) {
+    case 1:
+        tc = parse_timecodesv1(p, end, total);
+        if (!tc)
+            *error = "error parsing timecodes file";
+        break;
+    case 2:
+    case 4:
+        tc = parse_timecodesv2(p, end, ver == 4);
+        if (!tc)
+            *error = "error parsing timecodes file";
+        else
+            cache_add(filename, size, mtime, tc);
+        break;
+    default:
+        *error = "invalid timecodes file";
     }
 
-    if (n < total) {
-        free(ts);
-        return 0;
+    unmap_file(&mf);
+    mutex_unlock(&tc_cache_lock);
+
+    if (!tc)
+        return NULL;
+
+check:
+    if (tc->count < total) {
+        close_timecodes(tc);
+        *error = "timecodes file had less frames than expected";
+        return NULL;
     }
 
-    ud->timestamp = ts;
+    return tc;
+}
 
-    return 1;
+void close_timecodes(timecodes* tc)
+{
+    tc_entry** pe;
+
+    if (!tc)
+        return;
+
+    mutex_lock(&tc_cache_lock);
+
+    for (pe = &tc_cache; *pe; pe = &(*pe)->next) {
+        if ((*pe)->tc == tc) {
+            tc_entry* e = *pe;
+
+            if (--e->refs == 0) {
+                *pe = e->next;
+                free(e->path);
+                free(e);
+                free_timecodes(tc);
+            }
+
+            mutex_unlock(&tc_cache_lock);
+            return;
+        }
+    }
+
+    mutex_unlock(&tc_cache_lock);
+
+    free_timecodes(tc);
 }
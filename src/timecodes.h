@@ -2,9 +2,18 @@
 #define _TIMECODE_H_
 
 #include "assrender.h"
+#include "fileio.h"
+#include "thread.h"
 
-int parse_timecodesv1(FILE* f, int total, udata* ud);
+// v1 keeps the exact running time every this many frames
+#define TC_CHECKPOINT 1024
 
-int parse_timecodesv2(FILE* f, int total, udata* ud);
+// reads a v1, v2 or v4 timecodes file, on failure returns NULL and sets
+// error to a message; v2/v4 tables are shared between callers of the same file
+timecodes* open_timecodes(const char* filename, int total, const char** error);
+
+void close_timecodes(timecodes* tc);
+
+int64_t timecodes_get(const timecodes* tc, int n);
 
 #endif
@@ -0,0 +1,109 @@
+#include "trace.h"
+#include "fileio.h"
+#include "stats.h"
+#include "thread.h"
+
+struct tracer {
+    char* path;
+    FILE* fp;
+    int64_t epoch;
+    int events;
+    int refs;
+    struct tracer* next;
+};
+
+static tracer* trace_list = NULL;
+static int trace_next_tid = 0;
+static mutex trace_lock = MUTEX_INITIALIZER;
+
+// small, stable ids for the threads that show up in a trace
+static THREAD_LOCAL int trace_tid;
+
+tracer* open_trace(const char* path)
+{
+    tracer* tr;
+
+    mutex_lock(&trace_lock);
+
+    for (tr = trace_list; tr; tr = tr->next) {
+        if (!strcmp(tr->path, path)) {
+            tr->refs++;
+            mutex_unlock(&trace_lock);
+            return tr;
+        }
+    }
+
+    tr = calloc(1, sizeof(tracer));
+    if (tr) {
+        tr->fp = open_utf8_filename(path, "wb");
+        tr->path = strdup(path);
+
+        if (!tr->fp || !tr->path) {
+            if (tr->fp)
+                fclose(tr->fp);
+            free(tr->path);
+            free(tr);
+            tr = NULL;
+        }
+    }
+
+    if (tr) {
+        // the array form, viewers accept it without the closing bracket,
+        // so a trace of a crashed process can still be loaded
+        fputs("[\n", tr->fp);
+        tr->epoch = monotonic_ns();
+        tr->refs = 1;
+        tr->next = trace_list;
+        trace_list = tr;
+    }
+
+    mutex_unlock(&trace_lock);
+
+    return tr;
+}
+
+void close_trace(tracer* tr)
+{
+    if (!tr)
+        return;
+
+    mutex_lock(&trace_lock);
+
+    if (--tr->refs == 0) {
+        for (tracer** p = &trace_list; *p; p = &(*p)->next) {
+            if (*p == tr) {
+                *p = tr->next;
+                break;
+            }
+        }
+
+        fputs("\n]\n", tr->fp);
+        fclose(tr->fp);
+        free(tr->path);
+        free(tr);
+    }
+
+    mutex_unlock(&trace_lock);
+}
+
+void trace_span(tracer* tr, const char* name, int filter, int frame, int64_t start, int64_t end, int64_t wait)
+{
+    if (!tr)
+        return;
+
+    mutex_lock(&trace_lock);
+
+    if (!trace_tid)
+        trace_tid = ++trace_next_tid;
+
+    fprintf(tr->fp,
+            "%s{\"name\":\"%s\",\"cat\":\"assrender\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"filter\":%d,\"frame\":%d",
+            tr->events++ ? ",\n" : "", name, trace_tid,
+            (start - tr->epoch) / 1e3, (end - start) / 1e3, filter, frame);
+    if (wait >= 0)
+        fprintf(tr->fp, ",\"wait_us\":%.3f", wait / 1e3);
+    fputs("}}", tr->fp);
+
+    mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,18 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "assrender.h"
+
+// Chrome trace-event JSON writer, loadable in chrome://tracing and Perfetto
+typedef struct tracer tracer;
+
+// instances tracing to the same path share one writer, returns NULL if the
+// file can't be created
+tracer* open_trace(const char* path);
+void close_trace(tracer* tr);
+
+// one span of the calling thread, start and end from monotonic_ns; wait is
+// only written when it isn't negative
+void trace_span(tracer* tr, const char* name, int filter, int frame, int64_t start, int64_t end, int64_t wait);
+
+#endif
@@ -0,0 +1,266 @@
+#include "trackcache.h"
+#include "fileio.h"
+#include "sub.h"
+#include "thread.h"
+
+typedef struct track_entry {
+    char* path;
+    char* cs;
+    long long size, mtime;
+    ASS_Track* track;
+    // the matrix from the header, "" if it has none
+    char* csp;
+    // the copies handed out, refs of them
+    ASS_Track** views;
+    int refs;
+    // being parsed, without the lock; track and csp aren't there yet
+    int loading;
+    struct track_entry* next;
+} track_entry;
+
+static track_entry* track_cache = NULL;
+static mutex track_cache_lock = MUTEX_INITIALIZER;
+// signalled when an entry is done loading
+static cond track_cache_loaded = COND_INITIALIZER;
+// cached tracks outlive the filter that loaded them, so they are parsed with
+// a library of their own, which goes away with the last of them
+static ASS_Library* cache_library = NULL;
+// files may be parsed by several filters at once, libass messages go out up
+// to the verbosity of the one that started loading last
+static counter cache_verbosity = 0;
+
+static int same_charset(const char* a, const char* b)
+{
+    return a == b || (a && b && !strcasecmp(a, b));
+}
+
+static ASS_Track* new_view(const ASS_Track* track)
+{
+    ASS_Track* view = malloc(sizeof(ASS_Track));
+
+    if (!view)
+        return NULL;
+
+    *view = *track;
+    view->events = malloc((track->n_events ? track->n_events : 1) * sizeof(ASS_Event));
+    if (!view->events) {
+        free(view);
+        return NULL;
+    }
+
+    memcpy(view->events, track->events, track->n_events * sizeof(ASS_Event));
+    view->max_events = track->n_events;
+
+    return view;
+}
+
+static void free_view(ASS_Track* view)
+{
+    // only render_priv is the copy's, and libass allocated it
+    for (int i = 0; i < view->n_events; i++) {
+        ASS_Event* event = view->events + i;
+
+        event->Name = event->Effect = event->Text = NULL;
+        ass_free_event(view, i);
+    }
+
+    free(view->events);
+    free(view);
+}
+
+static void free_entry(track_entry* e)
+{
+    ass_free_track(e->track);
+    free(e->views);
+    free(e->csp);
+    free(e->cs);
+    free(e->path);
+    free(e);
+}
+
+static void cache_msg(int level, const char* fmt, va_list va, void* data)
+{
+    msg_callback(level, fmt, va, (void*)(intptr_t)counter_get(&cache_verbosity));
+}
+
+static void release_library(void)
+{
+    if (!track_cache && cache_library) {
+        ass_library_done(cache_library);
+        cache_library = NULL;
+    }
+}
+
+// unused entries other than keep, or only those of path if it is given
+static void drop_unused(const track_entry* keep, const char* path)
+{
+    track_entry** pe = &track_cache;
+
+    while (*pe) {
+        track_entry* e = *pe;
+
+        if (!e->refs && !e->loading && e != keep && (!path || !strcmp(e->path, path))) {
+            *pe = e->next;
+            free_entry(e);
+        }
+        else
+            pe = &e->next;
+    }
+
+    release_library();
+}
+
+static void unlink_entry(track_entry* e)
+{
+    track_entry** pe = &track_cache;
+
+    while (*pe != e)
+        pe = &(*pe)->next;
+    *pe = e->next;
+}
+
+// with the lock held; it is released while the file is parsed, other
+// callers wanting the same file wait for it meanwhile
+static track_entry* load_entry(const char* filename, long long size, long long mtime, const char* cs,
+                               int verbosity, const char** error)
+{
+    char csp[BUFSIZ] = "";
+    track_entry* e;
+    ASS_Track* track;
+
+    if (!cache_library) {
+        if (!(cache_library = ass_library_init())) {
+            *error = "could not initialize libass";
+            return NULL;
+        }
+        // the same as init_ass, so the track comes out as it would there
+        ass_set_message_cb(cache_library, cache_msg, NULL);
+        ass_set_extract_fonts(cache_library, 0);
+        ass_set_style_overrides(cache_library, 0);
+    }
+
+    e = calloc(1, sizeof(track_entry));
+    if (!e || !(e->path = strdup(filename)) || (cs && !(e->cs = strdup(cs)))) {
+        *error = "out of memory";
+        if (e)
+            free(e->path);
+        free(e);
+        release_library();
+        return NULL;
+    }
+
+    e->size = size;
+    e->mtime = mtime;
+    e->loading = 1;
+    e->next = track_cache;
+    track_cache = e;
+
+    counter_set(&cache_verbosity, verbosity);
+
+    mutex_unlock(&track_cache_lock);
+    track = read_ass_file(cache_library, filename, cs, csp, error);
+    mutex_lock(&track_cache_lock);
+
+    e->loading = 0;
+    cond_broadcast(&track_cache_loaded);
+
+    if (track && !(e->csp = strdup(csp))) {
+        *error = "out of memory";
+        ass_free_track(track);
+        track = NULL;
+    }
+
+    if (!track) {
+        // those waiting for it find nothing and try themselves
+        unlink_entry(e);
+        free(e->cs);
+        free(e->path);
+        free(e);
+        release_library();
+        return NULL;
+    }
+
+    e->track = track;
+
+    return e;
+}
+
+ASS_Track* open_shared_track(ASS_Library* library, const char* filename, const char* cs, int verbosity,
+                             char* csp, const char** error)
+{
+    long long size, mtime;
+    track_entry* e;
+    ASS_Track* view = NULL;
+    ASS_Track** views;
+
+    *error = NULL;
+
+    if (!file_stat(filename, &size, &mtime))
+        return read_ass_file(library, filename, cs, csp, error);
+
+    mutex_lock(&track_cache_lock);
+
+    for (;;) {
+        for (e = track_cache; e; e = e->next)
+            if (e->size == size && e->mtime == mtime && same_charset(e->cs, cs) && !strcmp(e->path, filename))
+                break;
+
+        if (!e || !e->loading)
+            break;
+        cond_wait(&track_cache_loaded, &track_cache_lock);
+    }
+
+    if (!e) {
+        // older versions of the file nobody uses any more
+        drop_unused(NULL, filename);
+        e = load_entry(filename, size, mtime, cs, verbosity, error);
+    }
+
+    if (e) {
+        views = realloc(e->views, (e->refs + 1) * sizeof(ASS_Track*));
+        if (views)
+            e->views = views;
+
+        if (views && (view = new_view(e->track)) != NULL) {
+            e->views[e->refs++] = view;
+            if (*e->csp)
+                strcpy(csp, e->csp);
+        }
+        else {
+            *error = "out of memory";
+            drop_unused(NULL, NULL);
+        }
+    }
+
+    mutex_unlock(&track_cache_lock);
+
+    return view;
+}
+
+void close_track(ASS_Track* track)
+{
+    if (!track)
+        return;
+
+    mutex_lock(&track_cache_lock);
+
+    for (track_entry* e = track_cache; e; e = e->next) {
+        for (int i = 0; i < e->refs; i++) {
+            if (e->views[i] == track) {
+                e->views[i] = e->views[--e->refs];
+                free_view(track);
+
+                // keep only the latest unused file around
+                if (!e->refs)
+                    drop_unused(e, NULL);
+
+                mutex_unlock(&track_cache_lock);
+                return;
+            }
+        }
+    }
+
+    mutex_unlock(&track_cache_lock);
+
+    ass_free_track(track);
+}
@@ -0,0 +1,26 @@
+#ifndef _TRACKCACHE_H_
+#define _TRACKCACHE_H_
+
+#include "assrender.h"
+
+// Parsed ASS/SSA files are kept once per path, size, mtime and charset and
+// shared by every filter that loads them. Each caller gets its own shallow
+// copy of the track: styles and event text belong to the cached track, the
+// event array (and the render_priv libass keeps in it) to the copy. Copies
+// must not get events or styles added.
+//
+// Files are parsed without holding up filters that load other files, those
+// that want a file being parsed wait for it.
+//
+// The last file nobody uses any more is kept until another one takes its
+// place or it changes on disk, so a script that is evaluated again finds it.
+
+// like read_ass_file, library is only used when the file can't be looked up;
+// csp receives the matrix from the script header if it has one
+ASS_Track* open_shared_track(ASS_Library* library, const char* filename, const char* cs, int verbosity,
+                             char* csp, const char** error);
+
+// any track: shared copies are handed back, others freed
+void close_track(ASS_Track* track);
+
+#endif
@@ -0,0 +1,148 @@
+// Checks the per-minute views of split_track against the full track: at
+// random times, and at every bucket edge, a view must hold exactly the
+// events of the track that are shown then, in track order. libass' per-event
+// state in render_priv must follow the view in use and end up back in the
+// track, once, when the buckets are freed.
+//
+//   assrender_buckets
+
+#include <stdio.h>
+#include "buckets.h"
+
+#define EVENTS 20000
+#define LENGTH_MS (45 * 60000)
+#define PROBES 2000
+
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+static int64_t random_below(int64_t n)
+{
+    // xorshift64*
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (int64_t)((rng * 0x2545F4914F6CDD1DULL) >> 11) % n;
+}
+
+static int shown(const ASS_Event* event, int64_t ts)
+{
+    return event->Start <= ts && ts < event->Start + event->Duration;
+}
+
+// mostly short lines, some never shown and some spanning many buckets
+static void add_events(ASS_Track* track)
+{
+    for (int i = 0; i < EVENTS; i++) {
+        int eid = ass_alloc_event(track);
+        ASS_Event* event = track->events + eid;
+        int64_t kind = random_below(100);
+
+        event->Start = random_below(LENGTH_MS + 20000) - 10000;
+        if (kind < 2)
+            event->Duration = 0;
+        else if (kind < 4)
+            event->Duration = -random_below(5000);
+        else if (kind < 6)
+            event->Duration = random_below(LENGTH_MS);
+        else
+            event->Duration = 1 + random_below(8000);
+        event->Layer = (int)random_below(3);
+        event->ReadOrder = eid;
+        event->Text = strdup("x");
+        // stands in for what libass keeps there, freed with the event
+        event->render_priv = malloc(1);
+    }
+}
+
+static int check_time(track_buckets* tb, ASS_Track* track, int64_t ts)
+{
+    ASS_Track* view = bucket_track(tb, ts);
+    int v = 0;
+
+    for (int i = 0; i < track->n_events; i++) {
+        if (!shown(track->events + i, ts))
+            continue;
+
+        while (v < view->n_events && !shown(view->events + v, ts))
+            v++;
+
+        if (v == view->n_events || view->events[v].ReadOrder != track->events[i].ReadOrder) {
+            printf("at %" PRId64 " ms: event %d is missing from the view or out of order\n", ts, i);
+            return 0;
+        }
+
+        if (!view->events[v].render_priv || track->events[i].render_priv) {
+            printf("at %" PRId64 " ms: render_priv of event %d wasn't handed to the view\n", ts, i);
+            return 0;
+        }
+
+        v++;
+    }
+
+    for (; v < view->n_events; v++) {
+        if (shown(view->events + v, ts)) {
+            printf("at %" PRId64 " ms: the view shows event %d that the track doesn't\n", ts, view->events[v].ReadOrder);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    ASS_Library* library = ass_library_init();
+    ASS_Track* track = library ? ass_new_track(library) : NULL;
+    void** priv;
+    track_buckets* tb;
+    int ok = 1;
+
+    if (!track) {
+        fprintf(stderr, "could not initialize libass\n");
+        return 2;
+    }
+
+    add_events(track);
+
+    priv = malloc(track->n_events * sizeof(void*));
+    for (int i = 0; i < track->n_events; i++)
+        priv[i] = track->events[i].render_priv;
+
+    tb = split_track(track);
+    if (!tb) {
+        printf("a track of %d events over %d minutes wasn't split\n", EVENTS, LENGTH_MS / 60000);
+        return 1;
+    }
+
+    for (int64_t ts = -BUCKET_MS; ok && ts < LENGTH_MS + 2 * BUCKET_MS; ts += BUCKET_MS)
+        ok = check_time(tb, track, ts - 1) && check_time(tb, track, ts) && check_time(tb, track, ts + 1);
+
+    for (int i = 0; ok && i < PROBES; i++)
+        ok = check_time(tb, track, random_below(LENGTH_MS + 40000) - 20000);
+
+    free_track_buckets(tb);
+
+    for (int i = 0; ok && i < track->n_events; i++) {
+        if (track->events[i].render_priv != priv[i]) {
+            printf("render_priv of event %d didn't go back to the track\n", i);
+            ok = 0;
+        }
+    }
+
+    // too few events to be worth it
+    track->n_events = BUCKET_MIN_EVENTS - 1;
+    if (ok && (tb = split_track(track)) != NULL) {
+        printf("a track of %d events was split\n", track->n_events);
+        free_track_buckets(tb);
+        ok = 0;
+    }
+    track->n_events = EVENTS;
+
+    free(priv);
+    ass_free_track(track);
+    ass_library_done(library);
+
+    printf("%s\n", ok ? "views match the track" : "FAILED");
+
+    return !ok;
+}
@@ -0,0 +1,184 @@
+// Renders the synthetic scenes of bench/synth.c through make_sub_img /
+// make_sub_img16 and every apply_* kernel and compares a hash of each
+// output frame with the checked-in reference.
+//
+//   assrender_golden REFERENCE [FORMAT]       compare, optionally one format
+//   assrender_golden --update REFERENCE       rewrite the reference
+//
+// The kernels must also leave the row padding of the frame alone, and the
+// planar formats must come out the same when the overlay only covers the
+// images' box, as get_frame composites and blends it.
+
+#include <stdio.h>
+#include "synth.h"
+
+#define WIDTH 320
+#define HEIGHT 180
+#define PAD_BYTE 0xA5
+
+static uint64_t fnv1a(uint64_t h, const uint8_t* p, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+// hash of the visible samples, 0 if the padding was written to; with box
+// the overlay is cropped to the images and blended at their offset
+static uint64_t render(const synth_format* fmt, synth_scene* scene, int box)
+{
+    synth_frame frame;
+    uint8_t* sub_img[4];
+    uint8_t* data[3];
+    uint64_t h = 0xCBF29CE484222325ULL;
+    int bytes = fmt->bits > 8 ? 2 : 1;
+    int x = 0, y = 0, w = WIDTH, bh = HEIGHT;
+
+    if (box && !synth_bbox(fmt, scene->images, WIDTH, HEIGHT, &x, &y, &w, &bh))
+        w = bh = 0;
+
+    if (!synth_frame_new(&frame, fmt, WIDTH, HEIGHT, 12345) || !synth_sub_img_new(sub_img, fmt, w ? w : 1, bh ? bh : 1)) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    for (int i = 0; i < frame.planes; i++) {
+        int w = fmt->packed ? WIDTH * fmt->packed : i ? WIDTH >> fmt->ssw : WIDTH;
+        int rows = i ? HEIGHT >> fmt->ssh : HEIGHT;
+
+        for (int y = 0; y < rows; y++)
+            memset(frame.data[i] + y * frame.pitch[i] + w * bytes, PAD_BYTE, frame.pitch[i] - w * bytes);
+    }
+
+    for (int i = 0; i < frame.planes; i++) {
+        int ssw = i ? fmt->ssw : 0;
+        int ssh = i ? fmt->ssh : 0;
+
+        data[i] = frame.data[i] + (y >> ssh) * frame.pitch[i] + (x >> ssw) * bytes;
+    }
+
+    if (w) {
+        synth_overlay_box(fmt, scene->images, sub_img, x, y, w, bh);
+        fmt->apply(sub_img, data, frame.pitch, w, bh);
+    }
+
+    for (int i = 0; i < frame.planes && h; i++) {
+        int w = fmt->packed ? WIDTH * fmt->packed : i ? WIDTH >> fmt->ssw : WIDTH;
+        int rows = i ? HEIGHT >> fmt->ssh : HEIGHT;
+
+        for (int y = 0; y < rows; y++) {
+            const uint8_t* row = frame.data[i] + y * frame.pitch[i];
+
+            for (int x = w * bytes; x < frame.pitch[i]; x++) {
+                if (row[x] != PAD_BYTE) {
+                    h = 0;
+                    break;
+                }
+            }
+            if (!h)
+                break;
+            h = fnv1a(h, row, (size_t)w * bytes);
+        }
+    }
+
+    synth_sub_img_free(sub_img);
+    synth_frame_free(&frame);
+
+    return h;
+}
+
+int main(int argc, char** argv)
+{
+    int update = argc > 1 && !strcmp(argv[1], "--update");
+    const char* path = argc > 1 + update ? argv[1 + update] : NULL;
+    const char* only = !update && argc > 2 ? argv[2] : NULL;
+    FILE* fp;
+    int failed = 0, checked = 0;
+
+    if (!path) {
+        fprintf(stderr, "usage: assrender_golden [--update] REFERENCE [FORMAT]\n");
+        return 2;
+    }
+
+    if (!(fp = fopen(path, update ? "w" : "r"))) {
+        fprintf(stderr, "can't open '%s'\n", path);
+        return 2;
+    }
+
+    for (int k = 0; k < SCENE_COUNT; k++) {
+        synth_scene scene;
+
+        if (!synth_scene_new(&scene, k, WIDTH, HEIGHT)) {
+            fprintf(stderr, "out of memory\n");
+            return 2;
+        }
+
+        for (int f = 0; f < synth_format_count; f++) {
+            const synth_format* fmt = synth_formats + f;
+            uint64_t h;
+
+            if (only && strcmp(fmt->name, only))
+                continue;
+
+            h = render(fmt, &scene, 0);
+
+            if (update) {
+                fprintf(fp, "%s %s %016llx\n", scene.name, fmt->name, (unsigned long long)h);
+                continue;
+            }
+
+            // the reference is small, look the entry up from the start
+            char name[32], format[32];
+            unsigned long long expected = 0;
+            int found = 0;
+
+            rewind(fp);
+            while (fscanf(fp, "%31s %31s %llx", name, format, &expected) == 3) {
+                if (!strcmp(name, scene.name) && !strcmp(format, fmt->name)) {
+                    found = 1;
+                    break;
+                }
+            }
+
+            checked++;
+            if (!h) {
+                printf("FAIL %s %s: wrote into the row padding\n", scene.name, fmt->name);
+                failed++;
+            }
+            else if (!found) {
+                printf("FAIL %s %s: no reference\n", scene.name, fmt->name);
+                failed++;
+            }
+            else if (h != expected) {
+                printf("FAIL %s %s: %016llx, expected %016llx\n", scene.name, fmt->name, (unsigned long long)h, expected);
+                failed++;
+            }
+
+            // packed formats are only blended whole, through csri
+            if (!fmt->packed) {
+                uint64_t hb = render(fmt, &scene, 1);
+
+                checked++;
+                if (hb != h) {
+                    printf("FAIL %s %s: %016llx composited into its box, %016llx over the frame\n",
+                           scene.name, fmt->name, (unsigned long long)hb, (unsigned long long)h);
+                    failed++;
+                }
+            }
+        }
+
+        synth_scene_free(&scene);
+    }
+
+    fclose(fp);
+
+    if (!update) {
+        if (!checked) {
+            printf("FAIL no such format '%s'\n", only ? only : "");
+            return 1;
+        }
+        printf("%d of %d outputs match\n", checked - failed, checked);
+    }
+
+    return failed ? 1 : 0;
+}
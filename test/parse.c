@@ -0,0 +1,223 @@
+// Parses scripts of several layouts split into pieces with ass_read_split
+// and in one go with ass_read_memory, and compares the styles and every
+// field of every event, ReadOrder included. Layouts that can't be split
+// safely must come out the same through the fallback.
+//
+//   assrender_parse
+
+#include <stdio.h>
+#include "sub.h"
+
+#define EVENTS 3000
+
+typedef struct {
+    char* buf;
+    size_t len, cap;
+} script;
+
+static void add(script* s, const char* text)
+{
+    size_t len = strlen(text);
+
+    if (s->len + len + 1 > s->cap) {
+        s->cap = (s->len + len + 1) * 2;
+        s->buf = realloc(s->buf, s->cap);
+        if (!s->buf) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+
+    memcpy(s->buf + s->len, text, len + 1);
+    s->len += len;
+}
+
+enum {
+    PLAIN,
+    CRLF_BOM,       // Windows line ends and a byte order mark
+    COMMENTS,       // Comment lines in between, no newline at the end
+    FONTS_BEFORE,   // [Fonts] ahead of the events, left out of the other pieces' header
+    FONTS_AFTER,    // [Fonts] after the events, only read with the first piece
+    FEW_EVENTS,     // fewer lines than pieces
+    EARLY_DIALOGUE, // a Dialogue line before the Format line: not split
+    LATE_STYLES,    // styles after the events: not split
+    TWO_EVENTS,     // a second [Events] section: not split
+    LAYOUTS
+};
+
+static const char* layout_names[LAYOUTS] = {
+    "plain", "crlf_bom", "comments", "fonts_before", "fonts_after",
+    "few_events", "early_dialogue", "late_styles", "two_events"
+};
+
+static const char* format_line =
+    "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
+
+static void add_styles(script* s)
+{
+    add(s, "[V4+ Styles]\n"
+           "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, "
+           "Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, "
+           "Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n"
+           "Style: Default,sans-serif,20,&H00FFFFFF,&H000000FF,&H00000000,&H00000000,0,0,0,0,100,100,0,0,1,2,0,2,10,10,10,1\n"
+           "Style: Sign,serif,32,&H0000FFFF,&H000000FF,&H00000000,&H00000000,-1,0,0,0,100,100,0,0,1,2,0,8,10,10,10,1\n"
+           "\n");
+}
+
+static void add_fonts(script* s)
+{
+    add(s, "[Fonts]\nfontname: none.ttf\nABCDEFGH\n\n");
+}
+
+static void add_events(script* s, int layout, int count)
+{
+    char line[256];
+
+    for (int i = 0; i < count; i++) {
+        int start = i * 37 % 600000;
+        int end = start + 500 + i % 7 * 300;
+
+        snprintf(line, sizeof(line),
+                 "Dialogue: %d,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,%s,%s,%d,%d,%d,%s,%s line %d, with a comma%s",
+                 i % 3, start / 3600000, start / 60000 % 60, start / 1000 % 60, start / 10 % 100,
+                 end / 3600000, end / 60000 % 60, end / 1000 % 60, end / 10 % 100,
+                 i % 5 ? "Default" : "Sign", i % 11 ? "" : "actor", i % 4, i % 6, i % 9,
+                 i % 13 ? "" : "Karaoke", i % 2 ? "{\\i1}" : "", i, layout == CRLF_BOM ? "\r\n" : "\n");
+        add(s, line);
+
+        if (layout == COMMENTS && i % 10 == 0)
+            add(s, "Comment: 0,0:00:00.00,0:00:01.00,Default,,0,0,0,,a note\n");
+    }
+}
+
+static script build(int layout)
+{
+    script s = { 0 };
+
+    if (layout == CRLF_BOM)
+        add(&s, "\xEF\xBB\xBF");
+
+    add(&s, "[Script Info]\nScriptType: v4.00+\nPlayResX: 640\nPlayResY: 360\nYCbCr Matrix: TV.709\n\n");
+
+    if (layout != LATE_STYLES)
+        add_styles(&s);
+    if (layout == FONTS_BEFORE)
+        add_fonts(&s);
+
+    add(&s, "[Events]\n");
+    if (layout == EARLY_DIALOGUE)
+        add_events(&s, layout, 1);
+    add(&s, format_line);
+    add_events(&s, layout, layout == FEW_EVENTS ? 3 : EVENTS);
+
+    if (layout == LATE_STYLES) {
+        add(&s, "\n");
+        add_styles(&s);
+    }
+    if (layout == FONTS_AFTER) {
+        add(&s, "\n");
+        add_fonts(&s);
+    }
+    if (layout == TWO_EVENTS) {
+        add(&s, "\n[Events]\n");
+        add(&s, format_line);
+        add_events(&s, layout, 10);
+    }
+
+    // drop the last newline
+    if (layout == COMMENTS)
+        s.buf[--s.len] = 0;
+
+    return s;
+}
+
+static int same_text(const char* a, const char* b)
+{
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+static int compare(const ASS_Track* a, const ASS_Track* b, const char* name, int pieces)
+{
+    if (!a || !b) {
+        printf("%s, %d pieces: %s parse failed\n", name, pieces, a ? "split" : "serial");
+        return 0;
+    }
+
+    if (a->n_styles != b->n_styles || a->n_events != b->n_events) {
+        printf("%s, %d pieces: %d styles, %d events instead of %d, %d\n",
+               name, pieces, b->n_styles, b->n_events, a->n_styles, a->n_events);
+        return 0;
+    }
+
+    for (int i = 0; i < a->n_styles; i++) {
+        if (!same_text(a->styles[i].Name, b->styles[i].Name)) {
+            printf("%s, %d pieces: style %d differs\n", name, pieces, i);
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < a->n_events; i++) {
+        const ASS_Event* x = a->events + i;
+        const ASS_Event* y = b->events + i;
+
+        if (x->Start != y->Start || x->Duration != y->Duration || x->ReadOrder != y->ReadOrder ||
+            x->Layer != y->Layer || x->Style != y->Style ||
+            x->MarginL != y->MarginL || x->MarginR != y->MarginR || x->MarginV != y->MarginV ||
+            !same_text(x->Name, y->Name) || !same_text(x->Effect, y->Effect) || !same_text(x->Text, y->Text)) {
+            printf("%s, %d pieces: event %d differs\n", name, pieces, i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void quiet(int level, const char* fmt, va_list va, void* data)
+{
+}
+
+int main(void)
+{
+    static const int pieces[] = { 2, 3, 7, 16 };
+    ASS_Library* library = ass_library_init();
+    int ok = 1;
+
+    if (!library) {
+        fprintf(stderr, "could not initialize libass\n");
+        return 2;
+    }
+
+    // as init_ass sets it up
+    ass_set_message_cb(library, quiet, NULL);
+    ass_set_extract_fonts(library, 0);
+    ass_set_style_overrides(library, 0);
+
+    for (int layout = 0; layout < LAYOUTS; layout++) {
+        script s = build(layout);
+        ASS_Track* serial = ass_read_memory(library, s.buf, s.len, NULL);
+
+        for (int p = 0; p < (int)(sizeof(pieces) / sizeof(pieces[0])); p++) {
+            ASS_Track* split = ass_read_split(library, s.buf, s.len, NULL, pieces[p]);
+
+            ok &= compare(serial, split, layout_names[layout], pieces[p]);
+            if (split)
+                ass_free_track(split);
+        }
+
+        // scripts with a charset are recoded in one go
+        ASS_Track* recoded = ass_read_split(library, s.buf, s.len, "UTF-8", 4);
+
+        ok &= compare(serial, recoded, layout_names[layout], 4);
+        if (recoded)
+            ass_free_track(recoded);
+        if (serial)
+            ass_free_track(serial);
+        free(s.buf);
+    }
+
+    ass_library_done(library);
+
+    printf("%s\n", ok ? "split and serial parses match" : "FAILED");
+
+    return !ok;
+}
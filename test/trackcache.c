@@ -0,0 +1,178 @@
+// Opens a script through the track cache the way filters do and checks the
+// sharing: copies of one file share its parsed text, the last unused file
+// is kept for the next filter, and a rewritten file is parsed again while
+// the copies of the old one stay as they were. Filters created on several
+// threads at once must all get the same track.
+//
+//   assrender_trackcache SCRATCH_FILE
+
+#include <stdio.h>
+#include "trackcache.h"
+#include "fileio.h"
+
+#define THREADS 8
+
+static const char* path;
+// counted from several threads
+static counter failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            counter_inc(&failures); \
+        } \
+    } while (0)
+
+// version is a single character, so every version has the same size
+static void write_script(char version)
+{
+    FILE* fp = fopen(path, "wb");
+
+    if (!fp) {
+        fprintf(stderr, "could not write '%s'\n", path);
+        exit(2);
+    }
+
+    fprintf(fp, "[Script Info]\nScriptType: v4.00+\nYCbCr Matrix: TV.709\n\n"
+                "[V4+ Styles]\nFormat: Name, Fontname, Fontsize\nStyle: Default,sans-serif,20\n\n"
+                "[Events]\nFormat: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n"
+                "Dialogue: 0,0:00:00.00,0:00:01.00,Default,,0,0,0,,version %c\n"
+                "Dialogue: 0,0:00:01.00,0:00:02.00,Default,,0,0,0,,second line\n", version);
+    fclose(fp);
+}
+
+// rewrites the file until the change can be told from its time stamp,
+// which takes a while on file systems that keep coarse times only
+static void rewrite_script(char version)
+{
+    long long size, before, after;
+
+    if (!file_stat(path, &size, &before))
+        before = -1;
+
+    for (int i = 0; i < 400; i++) {
+        write_script(version);
+        if (!file_stat(path, &size, &after) || after != before)
+            return;
+#if defined(_MSC_VER) || defined(__MINGW32__)
+        Sleep(10);
+#else
+        usleep(10000);
+#endif
+    }
+}
+
+static ASS_Track* open_track(ASS_Library* library, const char* cs, char* csp)
+{
+    const char* error;
+    ASS_Track* track = open_shared_track(library, path, cs, 0, csp, &error);
+
+    CHECK(track, "could not open '%s': %s", path, error ? error : "parse failed");
+
+    return track;
+}
+
+static int has_text(const ASS_Track* track, const char* text)
+{
+    return track && track->n_events == 2 && track->events[0].Text && !strcmp(track->events[0].Text, text);
+}
+
+static void* open_close(void* arg)
+{
+    ASS_Library* library = arg;
+    char csp[BUFSIZ] = "";
+
+    for (int i = 0; i < 50; i++) {
+        ASS_Track* track = open_track(library, NULL, csp);
+        int ok = has_text(track, "version 3");
+
+        CHECK(ok, "a thread got the wrong track");
+        close_track(track);
+        if (!ok)
+            break;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    ASS_Library* library;
+    char csp[BUFSIZ] = "";
+    const char* error;
+    ASS_Track *a, *b, *c, *d;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: assrender_trackcache SCRATCH_FILE\n");
+        return 2;
+    }
+
+    path = argv[1];
+    library = ass_library_init();
+    if (!library) {
+        fprintf(stderr, "could not initialize libass\n");
+        return 2;
+    }
+
+    rewrite_script('1');
+
+    // two filters of the same file share one parse
+    a = open_track(library, NULL, csp);
+    b = open_track(library, NULL, csp);
+    CHECK(!strcmp(csp, "TV.709"), "the matrix wasn't passed on: '%s'", csp);
+    CHECK(has_text(a, "version 1") && has_text(b, "version 1"), "the copies don't hold the script");
+    CHECK(a && b && a != b && a->events != b->events, "the copies aren't copies");
+    CHECK(a && b && a->events[0].Text == b->events[0].Text, "the file was parsed twice");
+
+    // the last unused file is kept for the next filter
+    close_track(a);
+    close_track(b);
+    a = open_track(library, NULL, csp);
+    CHECK(has_text(a, "version 1"), "the kept track changed");
+
+    // another charset is another parse
+    c = open_track(library, "UTF-8", csp);
+    CHECK(has_text(c, "version 1"), "the recoded copy doesn't hold the script");
+    CHECK(a && c && a->events[0].Text != c->events[0].Text, "a different charset shared the parse");
+    close_track(c);
+
+    // a rewrite of the same size is parsed again, the old copy stays valid
+    rewrite_script('2');
+    b = open_track(library, NULL, csp);
+    CHECK(has_text(b, "version 2"), "the rewritten file wasn't read again");
+    CHECK(has_text(a, "version 1"), "the old copy changed under its filter");
+    close_track(a);
+
+    // the new version is shared like the first
+    d = open_track(library, NULL, csp);
+    CHECK(b && d && b->events[0].Text == d->events[0].Text, "the new version wasn't shared");
+    close_track(b);
+    close_track(d);
+
+    // filters created in parallel
+    rewrite_script('3');
+
+    thread threads[THREADS];
+    int started[THREADS];
+
+    for (int i = 0; i < THREADS; i++)
+        CHECK(started[i] = !thread_create(threads + i, open_close, library), "could not start a thread");
+    for (int i = 0; i < THREADS; i++)
+        if (started[i])
+            thread_join(threads[i]);
+
+    // tracks that aren't from the cache are freed as they are
+    close_track(ass_new_track(library));
+
+    remove(path);
+    a = open_shared_track(library, path, NULL, 0, csp, &error);
+    CHECK(!a && error, "a missing file was opened");
+
+    ass_library_done(library);
+
+    printf("%s\n", counter_get(&failures) ? "FAILED" : "the cache shares and reloads tracks");
+
+    return counter_get(&failures) != 0;
+}